@@ -0,0 +1,114 @@
+// **************************************************
+// api.cpp
+// エンジンライブラリのCインタフェース
+// **************************************************
+#include "head.hpp"
+#include "csar.hpp"
+#include "csar_api.h"
+
+// --------------------------------------------------
+// エンジンの実体
+// --------------------------------------------------
+struct csar_engine {
+  search_t *search;
+};
+
+// ==================================================
+// エンジンを生成する
+// カーネルの命令セットは最初の1回だけ選択する
+// ==================================================
+csar_engine* csar_new(void) {
+  static const bool isa_selected = select_isa(ISA_AUTO);
+  (void)isa_selected;
+  csar_engine *engine = new csar_engine;
+  engine->search = create_search();
+  return engine;
+}
+
+// ==================================================
+// エンジンを破棄する
+// ==================================================
+void csar_free(csar_engine *engine) {
+  destroy_search(engine->search);
+  delete engine;
+}
+
+// ==================================================
+// 探索の深さと読み切りを始める空きマス数を設定する
+// ==================================================
+void csar_set_limits(csar_engine *engine, int depth, int wld_empties, int exact_empties) {
+  engine->search->depth = depth;
+  engine->search->wld_empties = wld_empties;
+  engine->search->exact_empties = exact_empties;
+}
+
+// ==================================================
+// 1手の制限時間(ミリ秒)を設定する
+// ==================================================
+void csar_set_time_limit(csar_engine *engine, int msec) {
+  engine->search->time_limit = msec;
+}
+
+// ==================================================
+// 局面を設定する
+// 合法手がなければ相手の手番にする
+// 実際に探索する手番はcsar_side_to_moveで取得できる
+// ==================================================
+void csar_set_position(csar_engine *engine, uint64_t black, uint64_t white, int player) {
+  board_t board;
+  board.player = player == CSAR_WHITE ? WHITE : BLACK;
+  board.black = black;
+  board.white = white;
+  board.nblack = count_of_discs(black);
+  board.nwhite = count_of_discs(white);
+  board.legal_moves = get_legal_moves(&board);
+  check_board_status(&board);
+  set_position(engine->search, &board);
+}
+
+// ==================================================
+// 探索する側の手番を取得する
+// 設定した手番がパスなら相手の手番，終局なら0を返す
+// ==================================================
+int csar_side_to_move(csar_engine *engine) {
+  board_t *board = &engine->search->board;
+  if (board->status == OVER) {
+    return 0;
+  }
+  return board->player == WHITE ? CSAR_WHITE : CSAR_BLACK;
+}
+
+// ==================================================
+// 設定した局面を探索して評価値を返す
+// ==================================================
+int csar_search(csar_engine *engine) {
+  search_t *s = engine->search;
+  s->best_move = 0;
+  s->best_score = 0;
+  s->nodes = 0;
+  if (s->board.status == OVER) {
+    return 0;
+  }
+  return search(s);
+}
+
+// ==================================================
+// 最善手を取得する
+// ==================================================
+uint64_t csar_best_move(csar_engine *engine) {
+  return engine->search->best_move;
+}
+
+// ==================================================
+// 最善手の評価値を取得する
+// ==================================================
+int csar_best_score(csar_engine *engine) {
+  return engine->search->best_score;
+}
+
+// ==================================================
+// 探索したノード数を取得する
+// ==================================================
+uint64_t csar_nodes(csar_engine *engine) {
+  return engine->search->nodes;
+}
@@ -0,0 +1,215 @@
+// **************************************************
+// bench.cpp
+// 探索の速度と正しさのベンチマーク
+// 決まった局面集を探索して時間とノード数を記録し
+// 基準の結果と比べて遅くなっていないかを調べる
+// **************************************************
+#include <map>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "head.hpp"
+#include "csar.hpp"
+
+// --------------------------------------------------
+// 基準より遅いとみなす時間の比率とその最小の差(ミリ秒)
+// 短い探索の誤差で遅いと判定しないように差も見る
+// --------------------------------------------------
+#define BENCH_SLOWER   1.10
+#define BENCH_MIN_DIFF 100
+
+// --------------------------------------------------
+// 局面集の1局面
+// --------------------------------------------------
+typedef struct {
+  char name[32]; //局面の名前
+  int depth;     //探索の深さ(0なら最終石差まで読み切る)
+  int expected;  //正しい評価値
+  bool known;    //正しい評価値がわかっているかどうか
+  board_t board; //局面
+} bench_pos_t;
+
+// --------------------------------------------------
+// 1局面の結果
+// --------------------------------------------------
+typedef struct {
+  int score;      //評価値
+  uint64_t nodes; //探索したノード数
+  int64_t msec;   //探索時間(ミリ秒)
+} bench_result_t;
+
+// --------------------------------------------------
+// 関数のプロトタイプ宣言
+// --------------------------------------------------
+// 局面集の1行を読み込む
+bool parse_bench_line(const char*, bench_pos_t*);
+// 結果ファイルを読み込む
+std::map<std::string, bench_result_t> load_results(const char*);
+// 1局面を探索する
+bench_result_t run_bench(bench_pos_t*);
+
+// ==================================================
+// プログラムメイン
+// -b file  基準の結果ファイル(これと比べる)
+// -o file  結果ファイル(基準の更新に使う)
+// -e num   読み切りはこの空きマス数以下の局面だけにする
+// -i isa   カーネルの命令セットを固定する(base, bmi2, avx2)
+// 正しくない局面か基準より遅い局面があれば1を返す
+// ==================================================
+int main(int argc, char *argv[]) {
+  const char *base_path = NULL;
+  const char *out_path = NULL;
+  const char *isa_name = NULL;
+  int max_empties = 64;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:o:e:i:")) != -1) {
+    switch (opt) {
+      case 'b': base_path = optarg;         break;
+      case 'o': out_path = optarg;          break;
+      case 'e': max_empties = atoi(optarg); break;
+      case 'i': isa_name = optarg;          break;
+      default:
+        fprintf(stderr, "usage: %s [-b file] [-o file] [-e num] [-i base|bmi2|avx2] suite\n", argv[0]);
+        return 1;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "usage: %s [-b file] [-o file] [-e num] [-i base|bmi2|avx2] suite\n", argv[0]);
+    return 1;
+  }
+  // カーネルの命令セットを選択
+  isa_t isa = ISA_AUTO;
+  if (isa_name != NULL) {
+    if (strcmp(isa_name, "base") == 0) isa = ISA_BASE;
+    if (strcmp(isa_name, "bmi2") == 0) isa = ISA_BMI2;
+    if (strcmp(isa_name, "avx2") == 0) isa = ISA_AVX2;
+  }
+  if ((isa_name != NULL && isa == ISA_AUTO) || !select_isa(isa)) {
+    fprintf(stderr, "この命令セットは使えません: %s\n", isa_name);
+    return 1;
+  }
+  FILE *suite = fopen(argv[optind], "r");
+  if (suite == NULL) {
+    fprintf(stderr, "局面集を開けませんでした: %s\n", argv[optind]);
+    return 1;
+  }
+  std::map<std::string, bench_result_t> base;
+  if (base_path != NULL) {
+    base = load_results(base_path);
+  }
+  FILE *out = NULL;
+  if (out_path != NULL && (out = fopen(out_path, "w")) == NULL) {
+    fprintf(stderr, "結果ファイルを開けませんでした: %s\n", out_path);
+    fclose(suite);
+    return 1;
+  }
+
+  printf("%-8s %5s %6s %6s %12s %9s %10s  %s\n",
+         "name", "depth", "score", "expect", "nodes", "msec", "nps", "");
+  char line[256];
+  int wrong = 0, slower = 0;
+  uint64_t total_nodes = 0;
+  int64_t total_msec = 0;
+  while (fgets(line, sizeof(line), suite) != NULL) {
+    bench_pos_t pos;
+    if (!parse_bench_line(line, &pos)) continue;
+    int empties = 64 - count_of_discs(pos.board.black | pos.board.white);
+    if (pos.depth == 0 && empties > max_empties) continue;
+    bench_result_t r = run_bench(&pos);
+    total_nodes += r.nodes;
+    total_msec += r.msec;
+    // 正しさの判定
+    bool ok = !pos.known || r.score == pos.expected;
+    if (!ok) wrong++;
+    // 基準との比較
+    char note[64] = "";
+    auto b = base.find(pos.name);
+    if (b != base.end()) {
+      bool slow = r.msec > b->second.msec * BENCH_SLOWER && r.msec - b->second.msec >= BENCH_MIN_DIFF;
+      if (slow) slower++;
+      snprintf(note, sizeof(note), "time x%.2f nodes x%.2f%s",
+               (double)r.msec / std::max(b->second.msec, (int64_t)1),
+               (double)r.nodes / std::max(b->second.nodes, (uint64_t)1),
+               slow ? " 遅い" : "");
+    }
+    char expect[8] = "?";
+    if (pos.known) snprintf(expect, sizeof(expect), "%d", pos.expected);
+    printf("%-8s %5s %6d %6s %12llu %9lld %10.0f  %s%s\n",
+           pos.name, pos.depth == 0 ? "exact" : std::to_string(pos.depth).c_str(),
+           r.score, expect, (unsigned long long)r.nodes, (long long)r.msec,
+           r.nodes * 1000.0 / std::max(r.msec, (int64_t)1), ok ? "" : "誤り ", note);
+    fflush(stdout);
+    if (out != NULL) {
+      fprintf(out, "%s %d %llu %lld\n", pos.name, r.score, (unsigned long long)r.nodes, (long long)r.msec);
+    }
+  }
+  printf("total: %llu nodes %lld ms %.0f nps, %d wrong, %d slower\n",
+         (unsigned long long)total_nodes, (long long)total_msec,
+         total_nodes * 1000.0 / std::max(total_msec, (int64_t)1), wrong, slower);
+  fclose(suite);
+  if (out != NULL) fclose(out);
+  return wrong > 0 || slower > 0 ? 1 : 0;
+}
+
+// ==================================================
+// 局面集の1行を読み込む
+// 名前 深さ 正しい評価値 盤面 手番
+// 深さが0なら読み切り，評価値が?なら正しさは調べない
+// 盤面はa1, b1, ..., h8の順にX(黒)，O(白)，-(空き)の64文字
+// ==================================================
+bool parse_bench_line(const char *line, bench_pos_t *pos) {
+  char expected[8], cells[65], side[2];
+  if (line[0] == '#' || sscanf(line, "%31s %d %7s %64s %1s", pos->name, &pos->depth, expected, cells, side) != 5
+      || strlen(cells) != 64) {
+    return false;
+  }
+  pos->known = strcmp(expected, "?") != 0;
+  pos->expected = atoi(expected);
+  return parse_board(cells, side[0], &pos->board);
+}
+
+// ==================================================
+// 結果ファイルを読み込む
+// 1行に 名前 評価値 ノード数 時間 を書く
+// ==================================================
+std::map<std::string, bench_result_t> load_results(const char *path) {
+  std::map<std::string, bench_result_t> results;
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "基準の結果ファイルがありません: %s\n", path);
+    return results;
+  }
+  char name[32];
+  unsigned long long nodes;
+  long long msec;
+  int score;
+  while (fscanf(fp, "%31s %d %llu %lld", name, &score, &nodes, &msec) == 4) {
+    results[name] = {score, (uint64_t)nodes, (int64_t)msec};
+  }
+  fclose(fp);
+  return results;
+}
+
+// ==================================================
+// 1局面を探索する
+// 局面ごとに新しい探索コンテキストを使うので
+// 置換表の中身が前の局面の結果に左右されない
+// ==================================================
+bench_result_t run_bench(bench_pos_t *pos) {
+  search_t *s = create_search();
+  if (pos->depth == 0) {
+    s->wld_empties = s->exact_empties = 64;
+  } else {
+    s->depth = pos->depth;
+    s->wld_empties = s->exact_empties = 0;
+  }
+  set_position(s, &pos->board);
+  bench_result_t r;
+  int64_t start = now_msec();
+  r.score = search(s);
+  r.msec = now_msec() - start;
+  r.nodes = s->nodes;
+  destroy_search(s);
+  return r;
+}
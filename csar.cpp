@@ -3,146 +3,634 @@
 // AIプログラム
 // 単純に石の数で評価する
 // **************************************************
+#include <new>
+#include <fcntl.h>
 #include <limits.h>
-#include <random>
-#include <unordered_map>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include "head.hpp"
+#include "csar.hpp"
 #include "eval.hpp"
 
 // --------------------------------------------------
-// 探索の深さ
+// 残り1手の局面でまとめて評価する子局面の数
+// 全部並べると枝刈りされるはずの手まで着手してしまうので
+// AVX2の1レジスタ分ずつ評価して枝刈りを調べる
 // --------------------------------------------------
-#define DEPTH 10
+#define FRONTIER_CHUNK 4
 
 // --------------------------------------------------
-// 置換表(transpose table)
+// 読み切りのノードのハッシュ値に混ぜる値
+// 中盤の評価値と読み切りの石差は別物なので
+// 同じ局面でも置換表のエントリを分ける
 // --------------------------------------------------
-std::unordered_map<bitboard_t, int> tt;
+#define SOLVE_HASH 0x9e3779b97f4a7c15
 
 // --------------------------------------------------
-// ハッシュ値計算に使う乱数
+// 置換表ファイルの定義
+// ヘッダの後ろにハッシュ値計算に使う乱数表と
+// エントリの一覧が続く
 // --------------------------------------------------
-bool initialized = false;
-uint64_t rand_mask[2][8][255];
+#define TT_FILE_MAGIC   "CSARTT\0" //終端と合わせて8バイト
+#define TT_FILE_VERSION 3
+
+typedef struct {
+  char     magic[8]; //ファイルの識別子
+  uint32_t version;  //ファイル形式のバージョン
+  uint32_t reserved; //未使用
+  uint64_t count;    //エントリの数
+  uint64_t checksum; //乱数表とエントリのチェックサム
+} tt_file_header_t;
 
 // --------------------------------------------------
-// 乱数(メルセンヌ・ツイスター64ビット版)
+// チェックポイントファイルの定義
+// ヘッダの後ろにルート局面で探索し終えた手が並ぶ
+// 置換表の深いエントリは別に"ファイル名.tt"へ保存する
 // --------------------------------------------------
-std::random_device seed_gen;
-std::mt19937_64 engine(seed_gen());
+#define CP_FILE_MAGIC   "CSARCP\0" //終端と合わせて8バイト
+#define CP_FILE_VERSION 1
+
+typedef struct {
+  char     magic[8]; //ファイルの識別子
+  uint32_t version;  //ファイル形式のバージョン
+  uint32_t count;    //探索し終えた手の数
+  uint64_t black;    //局面(黒石)
+  uint64_t white;    //局面(白石)
+  int32_t  player;   //局面(手番)
+  int32_t  depth;    //子局面の探索の深さ
+  int32_t  alpha;    //探索を始めたときの窓の下限
+  int32_t  beta;     //探索を始めたときの窓の上限
+  uint64_t checksum; //ヘッダ(この欄は0とする)と手のチェックサム
+} cp_file_header_t;
+
+typedef struct {
+  uint64_t move;  //手
+  int32_t  score; //評価値
+  int32_t  reserved; //未使用
+} cp_file_entry_t;
+
+typedef struct {
+  uint64_t hash;  //ハッシュ値
+  int32_t  score; //評価値
+  int16_t  depth; //残り深さ
+  int16_t  bound; //評価値の種類
+} tt_file_entry_t;
 
 // --------------------------------------------------
 // 関数のプロトタイプ宣言
 // --------------------------------------------------
-// 初期化
-bool initialize();
-// ネガマックス法による探索
-int nega_max_search(board_t*, int, int, int, bool);
+// ルート局面の探索
+int search_root(search_t*, board_t*, int, int, int, bitboard_t*);
+// 終盤の読み切り
+int solve(search_t*, board_t*, int, bitboard_t*);
+// 探索スタックを使った探索の本体
+int run_stack(search_t*);
+// ノードを調べる
+bool enter_node(search_t*, node_t*, int*);
+// 子ノードを積む
+node_t* push_child(node_t*);
+// 残り1手の局面の探索
+int search_frontier(search_t*, board_t*, int, int);
 // 盤面の状態をfromからdestへコピーする
 void board_copy(board_t*, board_t*);
 // ハッシュ値生成
-uint64_t make_hash(board_t*);
+uint64_t make_hash(search_t*, board_t*);
+// 制限時間を過ぎたかどうか
+bool time_over(search_t*);
+// チェックサム計算
+uint64_t checksum(const uint8_t*, size_t, uint64_t);
+// 置換表ファイルを書き込む
+bool write_tt_file(search_t*, const char*, int);
+// 置換表を引く
+tt_entry_t* probe_tt(search_t*, uint64_t);
+// 置換表に登録する
+void store_tt(search_t*, uint64_t, int, int, bound_t);
+// チェックポイントを保存する
+bool save_checkpoint(search_t*);
+// チェックポイントを読み込む
+bool load_checkpoint(search_t*, board_t*);
+// チェックポイントを削除する
+void remove_checkpoint(search_t*);
 
 // ==================================================
-// 初期化
+// 探索コンテキストを生成する
 // ==================================================
-bool initialize() {
+search_t* create_search() {
+  search_t *s = new search_t();
+  s->depth = DEPTH;
+  s->wld_empties = WLD_EMPTIES;
+  s->exact_empties = EXACT_EMPTIES;
+  s->time_limit = 0;
+  s->solving = false;
+  s->watch_fd = -1;
+  s->sp = -1;
+  s->root.count = 0;
+  s->root.resumed = false;
+  s->checkpoint = NULL;
+  s->checkpoint_at = 0;
+  s->checkpoint_depth = INT_MAX;
+  s->tt = NULL;
+  s->tt_age = 0;
+  if (!resize_tt(s, TT_SIZE_MB)) {
+    delete s;
+    throw std::bad_alloc();
+  }
+  // ハッシュ値計算に使う乱数の初期化
+  std::random_device seed_gen;
+  s->engine.seed(seed_gen());
   for (int i = 0; i < 2; i++) {
     for (int j = 0; j < 8; j++) {
-      for (int k = 0; k < 255; k++) {
-        rand_mask[i][j][k] = engine();
+      for (int k = 0; k < 256; k++) {
+        s->rand_mask[i][j][k] = s->engine();
       }
     }
   }
+  return s;
+}
+
+// ==================================================
+// 探索コンテキストを破棄する
+// ==================================================
+void destroy_search(search_t *s) {
+  munmap(s->tt, (s->tt_mask + 1) * TT_BUCKET * sizeof(tt_entry_t));
+  delete s;
+}
+
+// ==================================================
+// 置換表の大きさ(MB)を変えて空にする
+// バケツ数は2のべき乗に切り下げる
+// 無名マップは触れるまで物理メモリを使わないので
+// 大きな置換表でも確保した直後はすぐに戻る
+// ==================================================
+bool resize_tt(search_t *s, size_t mb) {
+  size_t buckets = 1;
+  while (buckets * 2 * TT_BUCKET * sizeof(tt_entry_t) <= mb << 20) {
+    buckets *= 2;
+  }
+  size_t size = buckets * TT_BUCKET * sizeof(tt_entry_t);
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  if (s->tt != NULL) {
+    munmap(s->tt, (s->tt_mask + 1) * TT_BUCKET * sizeof(tt_entry_t));
+  }
+  s->tt = (tt_entry_t*)map;
+  s->tt_mask = buckets - 1;
   return true;
 }
 
+// ==================================================
+// 置換表を空にする
+// ==================================================
+void clear_tt(search_t *s) {
+  memset(s->tt, 0, (s->tt_mask + 1) * TT_BUCKET * sizeof(tt_entry_t));
+}
+
+// ==================================================
+// 探索する局面を設定する
+// ==================================================
+void set_position(search_t *s, board_t *board) {
+  board_copy(&s->board, board);
+}
+
+// ==================================================
+// 設定した局面を探索して評価値を返す
+// 最善手と評価値はコンテキストにも格納する
+// 勝敗のみ読み切ったときの評価値は勝ち1，引き分け0
+// 負けは常に石差まで読み切るので評価値は石差
+// ==================================================
+int search(search_t *s) {
+  board_t *board = &s->board;
+  int empties = 64 - count_of_discs(board->black | board->white);
+  s->stopped = false;
+  s->deadline = s->time_limit > 0 ? now_msec() + s->time_limit : 0;
+  s->check_at = s->nodes;
+  s->tt_age++;
+  // 時間制限がなければ決めた深さまで探索
+  if (s->deadline == 0) {
+    // 終盤は読み切る
+    if (empties <= s->wld_empties) {
+      s->best_score = solve(s, board, empties, &s->best_move);
+      return s->best_score;
+    }
+    // INT_MINは符号反転するとオーバーフローするので-INT_MAXを使う
+    s->best_score = search_root(s, board, s->depth, -INT_MAX, INT_MAX, &s->best_move);
+    return s->best_score;
+  }
+  // 時間制限があるときは1手ずつ深くしていき
+  // 時間切れになったら最後に探索しきった深さの結果を使う
+  bitboard_t move;
+  int score;
+  s->best_move = board->legal_moves & (~board->legal_moves + 1);
+  s->best_score = 0;
+  for (int depth = 1; depth <= s->depth && depth < empties; depth++) {
+    score = search_root(s, board, depth, -INT_MAX, INT_MAX, &move);
+    if (s->stopped) return s->best_score;
+    s->best_move = move;
+    s->best_score = score;
+  }
+  // 時間が残っていれば終盤は読み切る
+  if (empties <= s->wld_empties) {
+    score = solve(s, board, empties, &move);
+    if (s->stopped) return s->best_score;
+    s->best_move = move;
+    s->best_score = score;
+  }
+  return s->best_score;
+}
+
 // ==================================================
 // AIの手を取得する
 // ==================================================
-bitboard_t get_csar_move(board_t *board) {
-  // 初期化
-  if (!initialized) {
-    initialized = initialize();
+bitboard_t get_csar_move(search_t *s, board_t *board) {
+  set_position(s, board);
+  search(s);
+  return s->best_move;
+}
+
+// ==================================================
+// 終盤の読み切り
+// 最善手をmoveに格納して評価値を返す
+// まず(-1, +1)の窓で勝敗だけを読み切り
+// 空きマスが少ないか負けならその結果で窓を絞って石差を求める
+// 勝敗の探索結果は置換表に残るので石差の探索でも使える
+// ==================================================
+int solve(search_t *s, board_t *board, int empties, bitboard_t *move) {
+  // チェックポイントを使うなら前回の続きから読み切り
+  // 以後は一定時間ごとにチェックポイントを保存する
+  // 残り深さが半分以上のエントリをチェックポイントに保存する
+  if (s->checkpoint != NULL) {
+    s->checkpoint_depth = (empties-1) / 2;
+    load_checkpoint(s, board);
+    s->checkpoint_at = now_msec() + CHECKPOINT_INTERVAL * 1000;
+  }
+  // 葉と終局は評価関数ではなく石差で評価する
+  s->solving = true;
+  // 石差の読み切りの途中から再開するなら勝敗は読み切り済み
+  int wld, score;
+  if (s->root.resumed && s->root.beta == 65) {
+    wld = 1;
+  } else if (s->root.resumed && s->root.alpha == -65) {
+    wld = -1;
+  } else {
+    wld = search_root(s, board, empties-1, -1, 1, move);
+  }
+  // 引き分けなら石差も0で確定
+  // 負けなら(-1, +1)の窓ではどの手もalphaを超えず
+  // 最初の合法手が選ばれているだけなので空きマスが多くても
+  // 石差を読み切って最も差の小さい負け方の手を選ぶ
+  if (wld == 0 || s->stopped || (empties > s->exact_empties && wld > 0)) {
+    score = wld;
+  // 勝ちなら(0, 64)，負けなら(-64, 0)の範囲で石差を求める
+  } else if (wld > 0) {
+    score = search_root(s, board, empties-1, 0, 65, move);
+  } else {
+    score = search_root(s, board, empties-1, -65, 0, move);
+  }
+  // 読み切れたらチェックポイントはもう要らない
+  if (s->checkpoint != NULL) {
+    s->checkpoint_at = 0;
+    s->checkpoint_depth = INT_MAX;
+    if (!s->stopped) remove_checkpoint(s);
   }
+  s->solving = false;
+  return score;
+}
+
+// ==================================================
+// ルート局面の探索
+// 最善手をmoveに格納して評価値を返す
+// どの手もalpha以下なら最初の合法手を格納する
+// ==================================================
+int search_root(search_t *s, board_t *board, int depth, int alpha, int beta, bitboard_t *move) {
   // 盤面のバックアップ
   board_t backup;
   board_copy(&backup, board);
+  // チェックポイントから読み込んだ同じ探索なら
+  // 探索し終えた手はその評価値を使う
+  root_state_t *r = &s->root;
+  bool replay = r->resumed && r->black == board->black && r->white == board->white
+             && r->player == board->player && r->depth == depth && r->alpha == alpha && r->beta == beta;
+  r->resumed = false;
+  if (!replay) {
+    r->black  = board->black;
+    r->white  = board->white;
+    r->player = board->player;
+    r->depth  = depth;
+    r->alpha  = alpha;
+    r->beta   = beta;
+    r->count  = 0;
+  }
   // すべての合法手について繰り返し
-  bitboard_t mv, move = 0;
-  bitboard_t pos = 0x8000000000000000;
+  bitboard_t mv, pos = 0x8000000000000000;
   bitboard_t legal_moves = board->legal_moves;
-  int score, alpha = INT_MIN, beta = INT_MAX;
+  *move = 0;
+  int score, done = 0;
   for (; pos != 0; pos = pos >> 1) {
     mv = (legal_moves & pos);
     if (mv == 0) continue;
-    // 着手して盤面を進める
-    next_turn(board, mv);
-    // 指し手の評価値を取得
-    score = -nega_max_search(board, DEPTH, alpha, beta, false);
-    // 盤面を元に戻す
-    board_copy(board, &backup);
+    if (*move == 0) *move = mv;
+    if (done < r->count && r->moves[done] == mv) {
+      // 探索し終えた手
+      score = r->scores[done++];
+    } else {
+      r->count = done;
+      // 着手して盤面を進める
+      next_turn(board, mv);
+      // 指し手の評価値を取得
+      score = -nega_max_search(s, board, depth, -beta, -alpha, false);
+      // 盤面を元に戻す
+      board_copy(board, &backup);
+      // 時間切れならこの探索結果は使えない
+      if (s->stopped) {
+        break;
+      }
+      // 探索し終えた手を記録
+      r->moves[r->count] = mv;
+      r->scores[r->count] = score;
+      r->count = ++done;
+    }
     // 評価値と差し手の更新
     if (alpha < score) {
       alpha = score;
-      move = mv;
+      *move = mv;
+    }
+    // 枝刈り
+    if (beta <= alpha) {
+      break;
     }
   }
-  return move;
+  return alpha;
 }
 
 // ==================================================
 // ネガマックス法による探索
+// 再帰呼び出しの代わりに探索スタックにノードを積んで探索する
+// 時間切れかwatch_fdが読めるようになって止めたときは
+// スタックをそのまま残して0を返すので
+// resume_searchで止めたノードから続けられる
+// ==================================================
+int nega_max_search(search_t *s, board_t *board, int depth, int alpha, int beta, bool pass) {
+  node_t *n = &s->stack[0];
+  board_copy(&n->board, board);
+  n->depth = depth;
+  n->alpha = alpha;
+  n->beta  = beta;
+  n->pass  = pass;
+  n->state = NODE_ENTER;
+  s->sp = 0;
+  return run_stack(s);
+}
+
+// ==================================================
+// 止めたネガマックス法の探索を再開する
+// 分散探索のワーカーはコーディネータからの窓の更新で止まり
+// スタックの一番下のノードの窓を狭めてからこれで続ける
+// 時間切れで止めたときは呼び出し側でdeadlineを延ばしておく
+// ==================================================
+int resume_search(search_t *s) {
+  if (s->sp < 0) {
+    return 0;
+  }
+  s->stopped = false;
+  s->check_at = s->nodes;
+  return run_stack(s);
+}
+
+// ==================================================
+// 探索スタックを積んだり降ろしたりして探索する
+// スタックの一番下のノードの評価値を返す
+// ==================================================
+int run_stack(search_t *s) {
+  node_t *n = &s->stack[s->sp];
+  int score;
+  while (true) {
+    // 時間切れならこのノードから再開できるように止める
+    if (time_over(s)) {
+      s->sp = n - s->stack;
+      return 0;
+    }
+    // 新しいノードを調べて値が決まらなければ子ノードを積む
+    s->nodes++;
+    if (!enter_node(s, n, &score)) {
+      n = push_child(n);
+      continue;
+    }
+    // 値が決まったノードを降ろして親ノードの値を更新する
+    // 親ノードの値も決まればさらに降ろす
+    while (true) {
+      if (n == s->stack) {
+        s->sp = -1;
+        return score;
+      }
+      n--;
+      score = -score;
+      // パスしたノードの値は子ノードの値そのもの
+      if (n->state == NODE_PASS) continue;
+      // 評価値を更新
+      if (n->alpha < score) {
+        n->alpha = score;
+      }
+      // 枝刈り
+      if (n->beta <= n->alpha) {
+        store_tt(s, n->hash, n->depth, n->alpha, LOWER);
+        score = n->alpha;
+        continue;
+      }
+      // すべての合法手を探索したら置換表に登録
+      // alphaを更新できなかったなら上限値
+      if (n->moves == 0) {
+        store_tt(s, n->hash, n->depth, n->alpha, n->alpha > n->alpha_orig ? EXACT : UPPER);
+        score = n->alpha;
+        continue;
+      }
+      break;
+    }
+    // 次の合法手の子ノードを積む
+    n = push_child(n);
+  }
+}
+
+// ==================================================
+// ノードを調べる
+// 子ノードを探索しなくても値が決まればscoreに格納してtrueを返す
 // ==================================================
-int nega_max_search(board_t *board, int depth, int alpha, int beta, bool pass) {
+bool enter_node(search_t *s, node_t *n, int *score) {
+  board_t *board = &n->board;
   // 想定の深さまで到達したら探索終了
-  if (depth == 0) {
-    return evaluate(board);
+  // 読み切りでは残り深さは空きマス数なので盤面が埋まっている
+  if (n->depth == 0) {
+    *score = s->solving ? final_score(board) : evaluate(board);
+    return true;
   }
   // 置換表に登録されているならその評価値を返す
-  uint64_t hash = make_hash(board);
-  if (tt.find(hash) != tt.end()) {
-    return tt[hash];
+  // 浅い探索で求めた評価値は使わない
+  // 上限や下限の値は窓の外にあるときだけ使える
+  n->hash = make_hash(s, board);
+  tt_entry_t *e = probe_tt(s, n->hash);
+  if (e != NULL && e->depth >= n->depth) {
+    if (e->bound == EXACT ||
+        (e->bound == LOWER && n->beta  <= e->score) ||
+        (e->bound == UPPER && e->score <= n->alpha)) {
+      *score = e->score;
+      return true;
+    }
   }
   // パスの処理
-  bitboard_t legal_moves = board->legal_moves;
-  if (legal_moves == 0) {
+  if (board->legal_moves == 0) {
     // 前回もパスなら終局
-    if (pass) {
-      return evaluate(board);
+    if (n->pass) {
+      *score = s->solving ? final_score(board) : evaluate(board);
+      return true;
     }
     // 手番を交代して同じ深さで探索
-    next_turn(board, 0);
-    return -nega_max_search(board, depth, -beta, -alpha, true);
+    n->state = NODE_PASS;
+    return false;
   }
-  // 盤面のバックアップ
-  board_t backup;
-  board_copy(&backup, board);
-  // すべての合法手について繰り返し
-  int score;
-  bitboard_t mv, pos = 0x8000000000000000;
-  for (; pos != 0; pos = pos >> 1) {
-    // 着手箇所
-    mv = (legal_moves & pos);
-    if (mv == 0) continue;
-    // 着手して盤面を進める
-    next_turn(board, mv);
-    // 次の深さを探索
-    score = -nega_max_search(board, depth-1, -beta, -alpha, false);
-    // 盤面を元に戻す
-    board_copy(board, &backup);
-    // 評価値を更新
-    if (alpha < score) {
-      alpha = score;
+  // 確定石による枝刈り
+  // 相手の確定石以外がすべて自石になっても
+  // alphaを超えられないならこれ以上探索しない
+  // 石差で評価するとき(読み切りは常に)だけ使える
+#ifdef EVAL_DIFF_DISCS
+  if (n->alpha > -64) {
+#else
+  if (s->solving && n->alpha > -64) {
+#endif
+    bitboard_t stable = get_stable_discs(get_opp_bb(board), get_own_bb(board));
+    if (64 - 2 * count_of_discs(stable) <= n->alpha) {
+      *score = n->alpha;
+      return true;
     }
-    // 枝刈り
-    if (beta <= alpha) {
-      return alpha;
+  }
+  // 残り1手なら子局面をまとめて評価する
+  n->alpha_orig = n->alpha;
+  if (n->depth == 1) {
+    int alpha = search_frontier(s, board, n->alpha, n->beta);
+    store_tt(s, n->hash, n->depth, alpha, n->beta <= alpha ? LOWER : alpha > n->alpha_orig ? EXACT : UPPER);
+    *score = alpha;
+    return true;
+  }
+  // すべての合法手を順に探索する
+  n->moves = board->legal_moves;
+  n->state = NODE_MOVES;
+  return false;
+}
+
+// ==================================================
+// 子ノードを積む
+// パスしたノードなら手番を交代しただけの局面を
+// そうでなければまだ探索していない合法手のうち
+// 左上のものを着手した局面を積む
+// ==================================================
+node_t* push_child(node_t *n) {
+  node_t *child = n + 1;
+  board_copy(&child->board, &n->board);
+  if (n->state == NODE_PASS) {
+    next_turn(&child->board, 0);
+    child->depth = n->depth;
+    child->pass  = true;
+  } else {
+    bitboard_t mv = 0x8000000000000000 >> __builtin_clzll(n->moves);
+    n->moves ^= mv;
+    next_turn(&child->board, mv);
+    child->depth = n->depth - 1;
+    child->pass  = false;
+  }
+  child->alpha = -n->beta;
+  child->beta  = -n->alpha;
+  child->state = NODE_ENTER;
+  return child;
+}
+
+// ==================================================
+// 置換表を引く
+// ハッシュ値の下位ビットでバケツを選び
+// その中からハッシュ値の一致するエントリを探す
+// ==================================================
+tt_entry_t* probe_tt(search_t *s, uint64_t hash) {
+  tt_entry_t *bucket = &s->tt[(hash & s->tt_mask) * TT_BUCKET];
+  for (int i = 0; i < TT_BUCKET; i++) {
+    if (bucket[i].hash == hash && bucket[i].depth > 0) {
+      return &bucket[i];
+    }
+  }
+  return NULL;
+}
+
+// ==================================================
+// 置換表に登録する
+// 同じ局面のエントリがあれば上書きし
+// なければバケツの中で前の探索の世代のものを優先して
+// 残り深さの最も浅いエントリを置き換える
+// 空きエントリは残り深さ0なので最初に使われる
+// ==================================================
+void store_tt(search_t *s, uint64_t hash, int depth, int score, bound_t bound) {
+  tt_entry_t *bucket = &s->tt[(hash & s->tt_mask) * TT_BUCKET];
+  tt_entry_t *e = &bucket[0];
+  int worst = INT_MAX;
+  for (int i = 0; i < TT_BUCKET; i++) {
+    if (bucket[i].hash == hash) {
+      e = &bucket[i];
+      break;
+    }
+    int value = bucket[i].depth + (bucket[i].age == s->tt_age ? 256 : 0);
+    if (value < worst) {
+      worst = value;
+      e = &bucket[i];
+    }
+  }
+  e->hash  = hash;
+  e->score = score;
+  e->depth = depth;
+  e->bound = bound;
+  e->age   = s->tt_age;
+}
+
+
+// ==================================================
+// 残り1手の局面の探索
+// 子局面を1つずつ進めて評価する代わりに
+// 着手後の石の配置だけを配列に並べてまとめて評価する
+// ==================================================
+int search_frontier(search_t *s, board_t *board, int alpha, int beta) {
+  bitboard_t own[FRONTIER_CHUNK], opp[FRONTIER_CHUNK];
+  int scores[FRONTIER_CHUNK], n;
+  bitboard_t me  = get_own_bb(board);
+  bitboard_t you = get_opp_bb(board);
+  bitboard_t mv, flip, pos = 0x8000000000000000;
+  while (pos != 0) {
+    // 子局面をFRONTIER_CHUNK個ずつ並べる
+    // 子局面の手番は相手になる
+    for (n = 0; pos != 0 && n < FRONTIER_CHUNK; pos = pos >> 1) {
+      mv = (board->legal_moves & pos);
+      if (mv == 0) continue;
+      flip = get_flip_pattern(board, mv);
+      own[n] = you ^ flip;
+      opp[n] = me | mv | flip;
+      n++;
+    }
+    // 読み切りでは子局面で盤面が埋まるので石差がそのまま最終石差
+    if (s->solving) {
+      diff_discs_batch(own, opp, n, scores);
+    } else {
+      evaluate_batch(own, opp, n, scores);
+    }
+    s->nodes += n;
+    // 着手順に評価値を更新して枝刈り
+    for (int i = 0; i < n; i++) {
+      if (alpha < -scores[i]) {
+        alpha = -scores[i];
+      }
+      if (beta <= alpha) {
+        return alpha;
+      }
     }
   }
-  // 置換表に登録
-  tt[hash] = alpha;
-  // 評価値を返す
   return alpha;
 }
 
@@ -161,14 +649,289 @@ void board_copy(board_t *dest, board_t *from) {
 
 // ==================================================
 // ハッシュ値生成
+// 読み切り中は中盤の探索と別の値にする
 // ==================================================
-uint64_t make_hash(board_t *board) {
+uint64_t make_hash(search_t *s, board_t *board) {
   uint64_t hash = 0;
   bitboard_t own = get_own_bb(board);
   bitboard_t opp = get_opp_bb(board);
   for (int i = 0; i < 8; i++) {
-    hash ^= rand_mask[0][i][(uint64_t)((own >> i * 8) & 255)];
-    hash ^= rand_mask[1][i][(uint64_t)((opp >> i * 8) & 255)];
+    hash ^= s->rand_mask[0][i][(uint64_t)((own >> i * 8) & 255)];
+    hash ^= s->rand_mask[1][i][(uint64_t)((opp >> i * 8) & 255)];
+  }
+  return s->solving ? hash ^ SOLVE_HASH : hash;
+}
+
+// ==================================================
+// 現在時刻(ミリ秒)
+// ==================================================
+int64_t now_msec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// ==================================================
+// 制限時間を過ぎたかどうか
+// watch_fdが読めるようになったときも探索を止める
+// 時刻の取得は重いので約1024ノードごとに調べる
+// ==================================================
+bool time_over(search_t *s) {
+  if (!s->stopped && (s->deadline != 0 || s->checkpoint_at != 0 || s->watch_fd >= 0) && s->check_at <= s->nodes) {
+    int64_t now = s->deadline != 0 || s->checkpoint_at != 0 ? now_msec() : 0;
+    s->stopped = s->deadline != 0 && now >= s->deadline;
+    s->check_at = s->nodes + 1024;
+    if (!s->stopped && s->watch_fd >= 0) {
+      struct pollfd pfd = {s->watch_fd, POLLIN, 0};
+      s->stopped = poll(&pfd, 1, 0) > 0;
+    }
+    // チェックポイントの保存もここで行う
+    if (s->checkpoint_at != 0 && now >= s->checkpoint_at) {
+      save_checkpoint(s);
+      s->checkpoint_at = now + CHECKPOINT_INTERVAL * 1000;
+    }
+  }
+  return s->stopped;
+}
+
+// ==================================================
+// チェックサム計算(FNV-1a)
+// ==================================================
+uint64_t checksum(const uint8_t *data, size_t size, uint64_t sum) {
+  for (size_t i = 0; i < size; i++) {
+    sum ^= data[i];
+    sum *= 0x00000100000001b3;
+  }
+  return sum;
+}
+
+// ==================================================
+// 置換表をファイルから読み込む
+// 乱数表もファイルのものに置き換えるので
+// 保存時と同じハッシュ値で置換表を引ける
+// ==================================================
+bool load_tt(search_t *s, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(tt_file_header_t) + sizeof(s->rand_mask)) {
+    close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  // ヘッダの検証
+  const uint8_t *p = (const uint8_t*)map;
+  const tt_file_header_t *header = (const tt_file_header_t*)p;
+  const uint8_t *body = p + sizeof(tt_file_header_t);
+  size_t body_size = size - sizeof(tt_file_header_t);
+  bool valid = memcmp(header->magic, TT_FILE_MAGIC, sizeof(header->magic)) == 0
+            && header->version == TT_FILE_VERSION
+            && body_size == sizeof(s->rand_mask) + header->count * sizeof(tt_file_entry_t)
+            && header->checksum == checksum(body, body_size, 0xcbf29ce484222325);
+  if (!valid) {
+    fprintf(stderr, "置換表ファイルが壊れています: %s\n", path);
+    munmap(map, size);
+    return false;
+  }
+  // 乱数表とエントリの読み込み
+  memcpy(s->rand_mask, body, sizeof(s->rand_mask));
+  const tt_file_entry_t *entry = (const tt_file_entry_t*)(body + sizeof(s->rand_mask));
+  clear_tt(s);
+  for (uint64_t i = 0; i < header->count; i++) {
+    store_tt(s, entry[i].hash, entry[i].depth, entry[i].score, (bound_t)entry[i].bound);
+  }
+  munmap(map, size);
+  return true;
+}
+
+// ==================================================
+// 置換表をファイルへ保存する
+// 残り深さがmin_depth以上のエントリのみ保存する
+// ==================================================
+bool save_tt(search_t *s, const char *path, int min_depth) {
+  return write_tt_file(s, path, min_depth);
+}
+
+// ==================================================
+// 置換表ファイルを書き込む
+// 残り深さがmin_depth以上のエントリのみ書き込む
+// 探索中のチェックポイントからも呼ばれるので
+// エントリを集め直さずに数えてから直接ファイルへ書く
+// 一時ファイルに書き出してから置き換えるので
+// 途中で止まっても元のファイルは壊れない
+// ==================================================
+bool write_tt_file(search_t *s, const char *path, int min_depth) {
+  if (min_depth < 1) min_depth = 1;
+  uint64_t size_tt = (s->tt_mask + 1) * TT_BUCKET;
+  uint64_t count = 0;
+  for (uint64_t i = 0; i < size_tt; i++) {
+    if (s->tt[i].depth >= min_depth) count++;
+  }
+  size_t body_size = sizeof(s->rand_mask) + count * sizeof(tt_file_entry_t);
+  size_t size = sizeof(tt_file_header_t) + body_size;
+  // 一時ファイルをマップする
+  char tmp[PATH_MAX];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    unlink(tmp);
+    return false;
+  }
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    unlink(tmp);
+    return false;
+  }
+  // 乱数表とエントリの書き込み
+  uint8_t *p = (uint8_t*)map;
+  uint8_t *body = p + sizeof(tt_file_header_t);
+  memcpy(body, s->rand_mask, sizeof(s->rand_mask));
+  tt_file_entry_t *entry = (tt_file_entry_t*)(body + sizeof(s->rand_mask));
+  for (uint64_t i = 0; i < size_tt; i++) {
+    tt_entry_t *e = &s->tt[i];
+    if (e->depth < min_depth) continue;
+    entry->hash  = e->hash;
+    entry->score = e->score;
+    entry->depth = e->depth;
+    entry->bound = e->bound;
+    entry++;
+  }
+  // ヘッダの書き込み
+  tt_file_header_t *header = (tt_file_header_t*)p;
+  memcpy(header->magic, TT_FILE_MAGIC, sizeof(header->magic));
+  header->version  = TT_FILE_VERSION;
+  header->reserved = 0;
+  header->count    = count;
+  header->checksum = checksum(body, body_size, 0xcbf29ce484222325);
+  bool ok = msync(map, size, MS_SYNC) == 0;
+  munmap(map, size);
+  if (!ok || rename(tmp, path) != 0) {
+    unlink(tmp);
+    return false;
+  }
+  return true;
+}
+
+// ==================================================
+// チェックポイントを保存する
+// ルート局面で探索し終えた手と探索中の窓に加えて
+// 残り深さがcheckpoint_depth以上の置換表のエントリを保存する
+// 置換表を先に置き換えるので探索状態のファイルが
+// 新しい置換表と組になっていなくても結果は変わらない
+// ==================================================
+bool save_checkpoint(search_t *s) {
+  root_state_t *r = &s->root;
+  char path[PATH_MAX], tmp[PATH_MAX];
+  snprintf(path, sizeof(path), "%s.tt", s->checkpoint);
+  if (!write_tt_file(s, path, s->checkpoint_depth)) {
+    return false;
+  }
+  // 探索状態の書き込み
+  cp_file_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CP_FILE_MAGIC, sizeof(header.magic));
+  header.version = CP_FILE_VERSION;
+  header.count   = r->count;
+  header.black   = r->black;
+  header.white   = r->white;
+  header.player  = r->player;
+  header.depth   = r->depth;
+  header.alpha   = r->alpha;
+  header.beta    = r->beta;
+  cp_file_entry_t entry[64];
+  memset(entry, 0, sizeof(entry));
+  for (int i = 0; i < r->count; i++) {
+    entry[i].move  = r->moves[i];
+    entry[i].score = r->scores[i];
+  }
+  header.checksum = checksum((const uint8_t*)&header, sizeof(header), 0xcbf29ce484222325);
+  header.checksum = checksum((const uint8_t*)entry, r->count * sizeof(cp_file_entry_t), header.checksum);
+  // 一時ファイルに書き出してから置き換える
+  snprintf(tmp, sizeof(tmp), "%s.tmp", s->checkpoint);
+  FILE *fp = fopen(tmp, "wb");
+  if (fp == NULL) {
+    return false;
   }
-  return hash;
-}
\ No newline at end of file
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+         && fwrite(entry, sizeof(cp_file_entry_t), r->count, fp) == (size_t)r->count
+         && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+  ok = fclose(fp) == 0 && ok;
+  if (!ok || rename(tmp, s->checkpoint) != 0) {
+    unlink(tmp);
+    return false;
+  }
+  return true;
+}
+
+// ==================================================
+// チェックポイントを読み込む
+// 局面が同じときだけ探索状態と置換表を読み込み
+// 次のsearch_rootで探索し終えた手を使えるようにする
+// ==================================================
+bool load_checkpoint(search_t *s, board_t *board) {
+  FILE *fp = fopen(s->checkpoint, "rb");
+  if (fp == NULL) {
+    return false;
+  }
+  cp_file_header_t header;
+  cp_file_entry_t entry[64];
+  bool valid = fread(&header, sizeof(header), 1, fp) == 1
+            && memcmp(header.magic, CP_FILE_MAGIC, sizeof(header.magic)) == 0
+            && header.version == CP_FILE_VERSION
+            && header.count <= 64
+            && fread(entry, sizeof(cp_file_entry_t), header.count, fp) == header.count;
+  fclose(fp);
+  if (valid) {
+    uint64_t sum = header.checksum;
+    header.checksum = 0;
+    header.checksum = checksum((const uint8_t*)&header, sizeof(header), 0xcbf29ce484222325);
+    valid = checksum((const uint8_t*)entry, header.count * sizeof(cp_file_entry_t), header.checksum) == sum;
+  }
+  if (!valid) {
+    fprintf(stderr, "チェックポイントファイルが壊れています: %s\n", s->checkpoint);
+    return false;
+  }
+  // 別の局面のチェックポイントは使わない
+  if (header.black != board->black || header.white != board->white || header.player != board->player) {
+    return false;
+  }
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s.tt", s->checkpoint);
+  load_tt(s, path);
+  root_state_t *r = &s->root;
+  r->black  = header.black;
+  r->white  = header.white;
+  r->player = (player_t)header.player;
+  r->depth  = header.depth;
+  r->alpha  = header.alpha;
+  r->beta   = header.beta;
+  r->count  = header.count;
+  for (int i = 0; i < r->count; i++) {
+    r->moves[i]  = entry[i].move;
+    r->scores[i] = entry[i].score;
+  }
+  r->resumed = true;
+  return true;
+}
+
+// ==================================================
+// チェックポイントを削除する
+// ==================================================
+void remove_checkpoint(search_t *s) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s.tt", s->checkpoint);
+  unlink(path);
+  unlink(s->checkpoint);
+}
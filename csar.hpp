@@ -2,9 +2,169 @@
 // csar.hpp
 // AIのヘッダファイル
 // ==================================================
+#include <random>
+
+// --------------------------------------------------
+// 探索の深さ
+// --------------------------------------------------
+#define DEPTH 10
+
+// --------------------------------------------------
+// 終盤の読み切りを始める空きマス数
+// WLD_EMPTIES以下で勝敗(勝ち/負け/引き分け)を読み切り
+// EXACT_EMPTIES以下ならさらに最終石差まで読み切る
+// 読み切りは評価関数を使わず終局の石差で評価し
+// 空きマスを残して終局したら空きマスは勝った方に数える
+// --------------------------------------------------
+#define WLD_EMPTIES   16
+#define EXACT_EMPTIES 14
+
+// --------------------------------------------------
+// チェックポイントを保存する間隔(秒)
+// --------------------------------------------------
+#define CHECKPOINT_INTERVAL 300
+
+// --------------------------------------------------
+// 置換表の大きさ(MB)
+// 置換表は探索コンテキストを作るときに確保したきりで
+// 満杯になったら古いエントリを置き換えて使い回す
+// --------------------------------------------------
+#define TT_SIZE_MB 64
+
+// --------------------------------------------------
+// 置換表の1バケツのエントリ数
+// 1バケツは64バイトでキャッシュラインに収まる
+// --------------------------------------------------
+#define TT_BUCKET 4
+
+// --------------------------------------------------
+// 置換表の評価値の種類
+// 窓の外で枝刈りされた値は上限か下限にしかならない
+// --------------------------------------------------
+typedef enum {
+  EXACT, //正確な値
+  LOWER, //下限(実際の値はこれ以上)
+  UPPER, //上限(実際の値はこれ以下)
+} bound_t;
+
+// --------------------------------------------------
+// 置換表のエントリ
+// 残り深さが1以上のノードだけを登録するので
+// 残り深さ0のエントリは空きとみなす
+// --------------------------------------------------
+typedef struct {
+  uint64_t hash;  //局面のハッシュ値
+  int32_t  score; //評価値
+  int16_t  depth; //評価値を求めたときの残り深さ
+  uint8_t  bound; //評価値の種類
+  uint8_t  age;   //登録した探索の世代
+} tt_entry_t;
+
+// --------------------------------------------------
+// ルート局面の探索状態
+// 探索し終えた手とその評価値を探索順に記録する
+// チェックポイントから再開するときはこれを使って
+// 探索し終えた手を探索し直さずに済ませる
+// --------------------------------------------------
+typedef struct {
+  bitboard_t black;      //局面(黒石)
+  bitboard_t white;      //局面(白石)
+  player_t player;       //局面(手番)
+  int depth;             //子局面の探索の深さ
+  int alpha;             //探索を始めたときの窓の下限
+  int beta;              //探索を始めたときの窓の上限
+  int count;             //探索し終えた手の数
+  bool resumed;          //チェックポイントから読み込んだかどうか
+  bitboard_t moves[64];  //探索し終えた手
+  int scores[64];        //その評価値
+} root_state_t;
+
+// --------------------------------------------------
+// 探索スタックの段数
+// 1段ごとに空きマスが1つ埋まるかパスするかで
+// パスは2回続かないので60マス分でも122段に収まる
+// --------------------------------------------------
+#define SEARCH_STACK_MAX 128
+
+// --------------------------------------------------
+// 探索スタックの1段(探索中のノード)
+// 再帰呼び出しの代わりにこれを積んで探索するので
+// 途中で止めてもノードの状態がすべてここに残る
+// --------------------------------------------------
+typedef enum {
+  NODE_ENTER, //まだ調べていない
+  NODE_MOVES, //合法手を順に探索中
+  NODE_PASS,  //パスして相手の手番を探索中
+} node_state_t;
+
+typedef struct alignas(64) {
+  board_t board;      //局面
+  bitboard_t moves;   //まだ探索していない合法手
+  uint64_t hash;      //局面のハッシュ値
+  int depth;          //残り深さ
+  int alpha;          //探索窓の下限(探索中に更新する)
+  int beta;           //探索窓の上限
+  int alpha_orig;     //探索を始めたときのalpha
+  bool pass;          //直前がパスかどうか
+  node_state_t state; //ノードの状態
+} node_t;
+
+// --------------------------------------------------
+// 探索コンテキスト
+// 探索の状態はすべてここに持つので
+// コンテキストが別なら複数のスレッドで同時に探索できる
+// --------------------------------------------------
+typedef struct {
+  board_t board;         //探索する局面
+  int depth;             //中盤の探索の深さ
+  int wld_empties;       //勝敗を読み切る空きマス数
+  int exact_empties;     //石差を読み切る空きマス数
+  int time_limit;        //1手の制限時間(ミリ秒，0なら無制限)
+  int64_t deadline;      //探索を打ち切る時刻(ミリ秒)
+  bool stopped;          //時間切れで探索を打ち切ったかどうか
+  bool solving;          //読み切り中かどうか(葉と終局を石差で評価する)
+  uint64_t check_at;     //次に時刻を調べるノード数
+  int watch_fd;          //読めるようになったら探索を止めるファイル記述子(-1なら監視しない)
+  bitboard_t best_move;  //最善手
+  int best_score;        //最善手の評価値
+  uint64_t nodes;        //探索したノード数
+  node_t stack[SEARCH_STACK_MAX]; //探索スタック
+  int sp;                //探索中のノードの段(-1なら探索していない)
+  root_state_t root;     //ルート局面の探索状態
+  const char *checkpoint; //チェックポイントファイル(NULLなら保存しない)
+  int64_t checkpoint_at; //次にチェックポイントを保存する時刻(0なら保存しない)
+  int checkpoint_depth;  //チェックポイントに保存する置換表のエントリの最小の残り深さ
+  tt_entry_t *tt;         //置換表(transpose table)
+  uint64_t tt_mask;       //置換表のバケツ数-1
+  uint8_t tt_age;         //置換表の世代(探索ごとに進める)
+  uint64_t rand_mask[2][8][256]; //ハッシュ値計算に使う乱数
+  std::mt19937_64 engine;        //乱数(メルセンヌ・ツイスター64ビット版)
+} search_t;
 
 // --------------------------------------------------
 // 関数のプロトタイプ宣言
 // --------------------------------------------------
+// 探索コンテキストを生成する
+search_t* create_search();
+// 探索コンテキストを破棄する
+void destroy_search(search_t*);
+// 探索する局面を設定する
+void set_position(search_t*, board_t*);
+// 設定した局面を探索して評価値を返す
+int search(search_t*);
 // AIの手を取得する
-bitboard_t get_csar_move(board_t*);
+bitboard_t get_csar_move(search_t*, board_t*);
+// ネガマックス法による探索
+int nega_max_search(search_t*, board_t*, int, int, int, bool);
+// 止めたネガマックス法の探索を再開する
+int resume_search(search_t*);
+// 置換表の大きさ(MB)を変えて空にする
+bool resize_tt(search_t*, size_t);
+// 置換表を空にする
+void clear_tt(search_t*);
+// 置換表をファイルから読み込む
+bool load_tt(search_t*, const char*);
+// 置換表をファイルへ保存する
+bool save_tt(search_t*, const char*, int);
+// 現在時刻(ミリ秒)
+int64_t now_msec();
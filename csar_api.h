@@ -0,0 +1,55 @@
+/* ==================================================
+ * csar_api.h
+ * エンジンライブラリ(libcsar.a)のCインタフェース
+ * エンジンごとに置換表などの探索状態を持つので
+ * 別のエンジンなら複数のスレッドで同時に探索できる
+ * ================================================== */
+#ifndef CSAR_API_H
+#define CSAR_API_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* --------------------------------------------------
+ * エンジン(中身は探索コンテキスト)
+ * -------------------------------------------------- */
+typedef struct csar_engine csar_engine;
+
+/* --------------------------------------------------
+ * 手番
+ * -------------------------------------------------- */
+#define CSAR_BLACK  1
+#define CSAR_WHITE -1
+
+/* --------------------------------------------------
+ * 関数のプロトタイプ宣言(api.cpp)
+ * -------------------------------------------------- */
+/* エンジンを生成する */
+csar_engine* csar_new(void);
+/* エンジンを破棄する */
+void csar_free(csar_engine*);
+/* 探索の深さと読み切りを始める空きマス数を設定する */
+void csar_set_limits(csar_engine*, int depth, int wld_empties, int exact_empties);
+/* 1手の制限時間(ミリ秒)を設定する(0なら深さのみで制限) */
+void csar_set_time_limit(csar_engine*, int msec);
+/* 局面を設定する(ビットボードは左上が最上位ビット，指定した手番がパスなら相手の手番になる) */
+void csar_set_position(csar_engine*, uint64_t black, uint64_t white, int player);
+/* 探索する側の手番を取得する(終局なら0) */
+int csar_side_to_move(csar_engine*);
+/* 設定した局面を探索してcsar_side_to_moveの手番から見た評価値を返す */
+int csar_search(csar_engine*);
+/* 最善手を取得する(合法手がなければ0) */
+uint64_t csar_best_move(csar_engine*);
+/* 最善手の評価値を取得する */
+int csar_best_score(csar_engine*);
+/* 探索したノード数を取得する */
+uint64_t csar_nodes(csar_engine*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
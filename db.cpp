@@ -0,0 +1,164 @@
+// **************************************************
+// db.cpp
+// 局面ファイルを扱うツール
+// **************************************************
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "head.hpp"
+#include "csar.hpp"
+#include "store.hpp"
+
+// --------------------------------------------------
+// 整列に使うメモリの既定値(MB)
+// --------------------------------------------------
+#define DEFAULT_SORT_MB 256
+
+// --------------------------------------------------
+// 関数のプロトタイプ宣言
+// --------------------------------------------------
+// ランダムな対局の局面を追記する
+int db_gen(const char*, int, uint64_t);
+// 局面ファイルを整列して索引を作る
+int db_sort(const char*, const char*, size_t);
+// 着手列の局面を索引から探す
+int db_find(const char*, const char*);
+// 使い方の表示
+int usage(const char*);
+
+// ==================================================
+// プログラムメイン
+// gen  file games [seed]  ランダムな対局の局面を追記する
+// sort in out [mb]        整列して重複を除き索引を作る
+// find index moves        着手列(例: f5d6c3)の局面を探す
+// ==================================================
+int main(int argc, char *argv[]) {
+  select_isa(ISA_AUTO);
+  if (argc >= 4 && strcmp(argv[1], "gen") == 0) {
+    return db_gen(argv[2], atoi(argv[3]), argc >= 5 ? strtoull(argv[4], NULL, 10) : 1);
+  }
+  if (argc >= 4 && strcmp(argv[1], "sort") == 0) {
+    return db_sort(argv[2], argv[3], argc >= 5 ? atoi(argv[4]) : DEFAULT_SORT_MB);
+  }
+  if (argc >= 4 && strcmp(argv[1], "find") == 0) {
+    return db_find(argv[2], argv[3]);
+  }
+  return usage(argv[0]);
+}
+
+// ==================================================
+// ランダムな対局の局面を追記する
+// 終局後に各局面の手番側から見た勝敗を付ける
+// ==================================================
+int db_gen(const char *path, int games, uint64_t seed) {
+  store_t *store = open_store(path);
+  if (store == NULL) {
+    fprintf(stderr, "局面ファイルを開けませんでした: %s\n", path);
+    return 1;
+  }
+  std::mt19937_64 engine(seed);
+  std::vector<board_t> history;
+  uint64_t count = 0;
+  int64_t start = now_msec();
+  bool ok = true;
+  for (int g = 0; g < games && ok; g++) {
+    board_t board;
+    initialize(&board);
+    check_board_status(&board);
+    history.clear();
+    while (board.status != OVER) {
+      history.push_back(board);
+      // 合法手からランダムに選ぶ
+      int n = engine() % count_of_discs(board.legal_moves);
+      bitboard_t moves = board.legal_moves;
+      while (n-- > 0) moves &= moves - 1;
+      next_turn(&board, moves & -moves);
+      check_board_status(&board);
+    }
+    for (auto &b : history) {
+      int diff = b.player == BLACK ? board.nblack - board.nwhite : board.nwhite - board.nblack;
+      outcome_t outcome = diff > 0 ? OUTCOME_WIN : diff < 0 ? OUTCOME_LOSS : OUTCOME_DRAW;
+      ok = ok && append_position(store, &b, outcome);
+    }
+    count += history.size();
+  }
+  ok = close_store(store) && ok;
+  if (!ok) {
+    fprintf(stderr, "局面ファイルに書き込めませんでした: %s\n", path);
+    return 1;
+  }
+  int64_t msec = std::max(now_msec() - start, (int64_t)1);
+  printf("%llu 局面 %lld ms (%.1f MB/s)\n", (unsigned long long)count, (long long)msec,
+         count * sizeof(pos_record_t) / 1000.0 / msec);
+  return 0;
+}
+
+// ==================================================
+// 局面ファイルを整列して索引を作る
+// ==================================================
+int db_sort(const char *in, const char *out, size_t mb) {
+  int64_t start = now_msec();
+  if (!sort_store(in, out, mb << 20)) {
+    fprintf(stderr, "局面ファイルを整列できませんでした: %s\n", in);
+    return 1;
+  }
+  int64_t msec = std::max(now_msec() - start, (int64_t)1);
+  struct stat st;
+  uint64_t size = stat(in, &st) == 0 ? st.st_size : 0;
+  pos_index_t *index = open_index(out);
+  if (index == NULL) {
+    fprintf(stderr, "索引を開けませんでした: %s\n", out);
+    return 1;
+  }
+  printf("%llu 局面 %lld ms (%.1f MB/s)\n", (unsigned long long)index->count, (long long)msec,
+         size / 1000.0 / msec);
+  close_index(index);
+  return 0;
+}
+
+// ==================================================
+// 着手列の局面を索引から探す
+// ==================================================
+int db_find(const char *path, const char *moves) {
+  pos_index_t *index = open_index(path);
+  if (index == NULL) {
+    fprintf(stderr, "索引を開けませんでした: %s\n", path);
+    return 1;
+  }
+  board_t board;
+  initialize(&board);
+  check_board_status(&board);
+  for (const char *p = moves; p[0] != '\0' && p[1] != '\0'; p += 2) {
+    if (p[0] < 'a' || 'h' < p[0] || p[1] < '1' || '8' < p[1]) break;
+    bitboard_t mv = cr_to_bb(p[0] - 'a', p[1] - '1');
+    if ((mv & board.legal_moves) == 0) {
+      fprintf(stderr, "合法手ではありません: %.2s\n", p);
+      close_index(index);
+      return 1;
+    }
+    next_turn(&board, mv);
+    check_board_status(&board);
+  }
+  const char *names[] = {"不明", "負け", "引き分け", "勝ち"};
+  outcome_t outcome;
+  if (find_position(index, &board, &outcome)) {
+    printf("あり (手番側の%s)\n", names[outcome]);
+  } else {
+    printf("なし\n");
+  }
+  close_index(index);
+  return 0;
+}
+
+// ==================================================
+// 使い方の表示
+// ==================================================
+int usage(const char *program) {
+  fprintf(stderr, "usage: %s gen file games [seed]\n", program);
+  fprintf(stderr, "       %s sort in out [mb]\n", program);
+  fprintf(stderr, "       %s find index moves\n", program);
+  return 1;
+}
@@ -103,6 +103,28 @@ bitboard_t cr_to_bb(int col, int row) {
   return 0x8000000000000000 >> (col + row*8);
 }
 
+// ==================================================
+// 文字列から局面を読み込む
+// 盤面はa1, b1, ..., h8の順にX(黒)，O(白)，-(空き)の64文字
+// 手番はXかO
+// ==================================================
+bool parse_board(const char *cells, char side, board_t *board) {
+  if (strlen(cells) < 64 || (side != 'X' && side != 'O')) {
+    return false;
+  }
+  board->black = board->white = 0;
+  for (int i = 0; i < 64; i++) {
+    if (cells[i] == 'X') board->black |= cr_to_bb(i % 8, i / 8);
+    if (cells[i] == 'O') board->white |= cr_to_bb(i % 8, i / 8);
+  }
+  board->player = side == 'O' ? WHITE : BLACK;
+  board->nblack = count_of_discs(board->black);
+  board->nwhite = count_of_discs(board->white);
+  board->legal_moves = get_legal_moves(board);
+  check_board_status(board);
+  return true;
+}
+
 // ==================================================
 // プレイヤーの入力を取得する
 // ==================================================
@@ -0,0 +1,579 @@
+// **************************************************
+// dist.cpp
+// 分散探索
+// コーディネータがルートから2手先まで展開して
+// 部分木をワーカー(別プロセスのcsar)に割り振る
+// **************************************************
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <vector>
+#include "head.hpp"
+#include "csar.hpp"
+#include "dist.hpp"
+
+// --------------------------------------------------
+// ワーカーの最大数
+// --------------------------------------------------
+#define MAX_WORKERS 64
+
+// --------------------------------------------------
+// ワーカーの接続を待つ時間(ミリ秒)
+// --------------------------------------------------
+#define ACCEPT_TIMEOUT 10000
+
+// --------------------------------------------------
+// メッセージの種類
+// --------------------------------------------------
+typedef enum {
+  MSG_JOB,    //探索の依頼(コーディネータ→ワーカー)
+  MSG_BOUND,  //探索窓の更新(コーディネータ→ワーカー)
+  MSG_RESULT, //探索の結果(ワーカー→コーディネータ)
+  MSG_QUIT,   //終了(コーディネータ→ワーカー)
+} msg_type_t;
+
+// --------------------------------------------------
+// メッセージ
+// 評価値と窓はその局面の手番から見た値
+// --------------------------------------------------
+typedef struct {
+  int32_t type;     //メッセージの種類
+  int32_t id;       //部分木の番号
+  int32_t depth;    //探索の深さ
+  int32_t alpha;    //探索窓の下限
+  int32_t beta;     //探索窓の上限
+  int32_t score;    //評価値
+  int32_t player;   //手番
+  int32_t reserved; //未使用
+  uint64_t black;   //黒石のビットボード
+  uint64_t white;   //白石のビットボード
+  uint64_t nodes;   //探索したノード数
+} dist_msg_t;
+
+// --------------------------------------------------
+// ルートの指し手
+// --------------------------------------------------
+typedef struct {
+  bitboard_t mv; //着手箇所
+  int upper;     //評価値の上限(応手の評価値の最小値)
+  int pending;   //未完了の部分木の数
+  bool done;     //評価値が確定したかどうか
+} root_move_t;
+
+// --------------------------------------------------
+// 部分木
+// --------------------------------------------------
+typedef struct {
+  board_t board; //部分木の局面
+  int move;      //ルートの指し手の番号
+  int sign;      //局面の手番がルートと同じなら1，違うなら-1
+  int depth;     //探索の深さ
+  int worker;    //担当のワーカー(未割り当ては-1，完了は-2)
+  int alpha;     //最後に送った探索窓の下限
+  int beta;      //最後に送った探索窓の上限
+} job_t;
+
+// --------------------------------------------------
+// コーディネータの状態
+// --------------------------------------------------
+char sock_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+int listen_fd = -1;
+int nworkers = 0;
+int worker_fd[MAX_WORKERS];
+int worker_job[MAX_WORKERS];
+pid_t worker_pid[MAX_WORKERS];
+
+// --------------------------------------------------
+// 関数のプロトタイプ宣言
+// --------------------------------------------------
+// メッセージを送信する
+bool send_msg(int, dist_msg_t*);
+// メッセージを受信する
+bool recv_msg(int, dist_msg_t*);
+// ルートから見た探索窓を部分木の手番から見た窓にする
+void job_window(job_t*, root_move_t*, int, int*, int*);
+// 部分木の探索窓を更新する
+void update_bounds(std::vector<job_t>&, std::vector<root_move_t>&, int);
+// 部分木をワーカーに割り当てる
+bool assign_job(int, std::vector<job_t>&, std::vector<root_move_t>&, int, bool);
+// 探索中のワーカーを打ち切って結果を捨てる
+void drain_workers();
+// 部分木を探索する(ワーカー)
+int search_job(search_t*, int, dist_msg_t*, board_t*, bool*);
+// 止まった探索を窓を更新しながら続ける(ワーカー)
+bool continue_job(search_t*, int, dist_msg_t*, int*, bool, int*, bool*);
+// 探索窓の更新を受け取る(ワーカー)
+void poll_bounds(int, int, int*, int*, bool*);
+
+// ==================================================
+// メッセージを送信する
+// ==================================================
+bool send_msg(int fd, dist_msg_t *msg) {
+  const char *p = (const char*)msg;
+  size_t rest = sizeof(dist_msg_t);
+  while (rest > 0) {
+    ssize_t n = send(fd, p, rest, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    rest -= n;
+  }
+  return true;
+}
+
+// ==================================================
+// メッセージを受信する
+// ==================================================
+bool recv_msg(int fd, dist_msg_t *msg) {
+  char *p = (char*)msg;
+  size_t rest = sizeof(dist_msg_t);
+  while (rest > 0) {
+    ssize_t n = recv(fd, p, rest, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    rest -= n;
+  }
+  return true;
+}
+
+// ==================================================
+// コーディネータを開始してワーカーの接続を待つ
+// ワーカーは実行中のプログラム自身を"-w path"付きで起動する
+// PATHから起動されたときもargv[0]ではなく/proc/self/exeを使い
+// カーネルの命令セットもコーディネータと揃える
+// ==================================================
+bool start_coordinator(const char *path, int n, const char *program) {
+  if (n > MAX_WORKERS) n = MAX_WORKERS;
+  // ソケットの作成
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return false;
+  }
+  strcpy(addr.sun_path, path);
+  strcpy(sock_path, path);
+  listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    return false;
+  }
+  unlink(path);
+  if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, n) != 0) {
+    close(listen_fd);
+    listen_fd = -1;
+    return false;
+  }
+  // ワーカーの起動
+  const char *isa_names[] = {"base", "base", "bmi2", "avx2"};
+  const char *isa_name = isa_names[get_isa()];
+  for (int i = 0; i < n; i++) {
+    worker_pid[i] = fork();
+    if (worker_pid[i] == 0) {
+      execl("/proc/self/exe", program, "-w", path, "-i", isa_name, (char*)NULL);
+      _exit(1);
+    }
+  }
+  // ワーカーの接続を待つ
+  struct pollfd pfd = {listen_fd, POLLIN, 0};
+  while (nworkers < n && poll(&pfd, 1, ACCEPT_TIMEOUT) > 0) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) continue;
+    worker_fd[nworkers] = fd;
+    worker_job[nworkers] = -1;
+    nworkers++;
+  }
+  return nworkers > 0;
+}
+
+// ==================================================
+// コーディネータを終了してワーカーを停止する
+// ==================================================
+void stop_coordinator() {
+  dist_msg_t msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.type = MSG_QUIT;
+  for (int i = 0; i < nworkers; i++) {
+    if (worker_fd[i] < 0) continue;
+    send_msg(worker_fd[i], &msg);
+    close(worker_fd[i]);
+  }
+  nworkers = 0;
+  if (listen_fd >= 0) {
+    close(listen_fd);
+    unlink(sock_path);
+    listen_fd = -1;
+  }
+  while (wait(NULL) > 0);
+}
+
+// ==================================================
+// ルートから見た探索窓[lo, hi]を部分木の手番から見た窓にする
+// 指し手の評価値は応手の評価値の最小値なので
+// 窓の上限はこれまでに求めた応手の評価値の最小値になる
+// ==================================================
+void job_window(job_t *job, root_move_t *move, int lo, int *alpha, int *beta) {
+  int hi = move->upper;
+  if (job->sign > 0) {
+    *alpha = lo;
+    *beta  = hi;
+  } else {
+    *alpha = -hi;
+    *beta  = -lo;
+  }
+}
+
+// ==================================================
+// 探索中の部分木の探索窓を更新する
+// 窓が狭くなった部分木のワーカーにだけ送る
+// ==================================================
+void update_bounds(std::vector<job_t> &jobs, std::vector<root_move_t> &moves, int lo) {
+  for (int i = 0; i < nworkers; i++) {
+    if (worker_fd[i] < 0 || worker_job[i] < 0) continue;
+    job_t *job = &jobs[worker_job[i]];
+    int alpha, beta;
+    job_window(job, &moves[job->move], lo, &alpha, &beta);
+    if (alpha == job->alpha && beta == job->beta) continue;
+    dist_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type  = MSG_BOUND;
+    msg.id    = worker_job[i];
+    msg.alpha = job->alpha = alpha;
+    msg.beta  = job->beta  = beta;
+    send_msg(worker_fd[i], &msg);
+  }
+}
+
+// ==================================================
+// 未割り当ての部分木をワーカーに割り当てる
+// 最初の指し手が確定するまでは他の指し手の部分木を
+// 割り当てない(先に良い下限を得て後の窓を狭くするため)
+// ==================================================
+bool assign_job(int w, std::vector<job_t> &jobs, std::vector<root_move_t> &moves, int lo, bool released) {
+  for (size_t i = 0; i < jobs.size(); i++) {
+    job_t *job = &jobs[i];
+    if (job->worker != -1 || moves[job->move].done) continue;
+    if (!released && job->move != 0) break;
+    dist_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type   = MSG_JOB;
+    msg.id     = i;
+    msg.depth  = job->depth;
+    msg.player = job->board.player;
+    msg.black  = job->board.black;
+    msg.white  = job->board.white;
+    job_window(job, &moves[job->move], lo, &job->alpha, &job->beta);
+    msg.alpha  = job->alpha;
+    msg.beta   = job->beta;
+    if (!send_msg(worker_fd[w], &msg)) {
+      return false;
+    }
+    job->worker = w;
+    worker_job[w] = i;
+    return true;
+  }
+  return false;
+}
+
+// ==================================================
+// ワーカーで分散探索してAIの手を取得する
+// ==================================================
+bitboard_t get_dist_move(search_t *s, board_t *board) {
+  // 終盤は1プロセスで十分速いので分散しない
+  int empties = 64 - count_of_discs(board->black | board->white);
+  if (nworkers == 0 || empties <= s->wld_empties) {
+    return get_csar_move(s, board);
+  }
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // --------------------------------------------------
+  // ルートから2手先まで展開して部分木を作る
+  // 相手がパスする指し手はその局面自体を部分木にする
+  // --------------------------------------------------
+  std::vector<root_move_t> moves;
+  std::vector<job_t> jobs;
+  bitboard_t mv, pos = 0x8000000000000000;
+  for (; pos != 0; pos = pos >> 1) {
+    mv = (board->legal_moves & pos);
+    if (mv == 0) continue;
+    root_move_t move = {mv, INT_MAX, 0, false};
+    board_t child = *board;
+    next_turn(&child, mv);
+    if (child.legal_moves == 0) {
+      jobs.push_back({child, (int)moves.size(), -1, s->depth, -1, 0, 0});
+      move.pending++;
+    }
+    bitboard_t rp = 0x8000000000000000;
+    for (; rp != 0; rp = rp >> 1) {
+      bitboard_t r = (child.legal_moves & rp);
+      if (r == 0) continue;
+      board_t grandchild = child;
+      next_turn(&grandchild, r);
+      jobs.push_back({grandchild, (int)moves.size(), 1, s->depth-1, -1, 0, 0});
+      move.pending++;
+    }
+    moves.push_back(move);
+  }
+
+  // --------------------------------------------------
+  // 部分木の探索結果を集めて指し手の評価値を決める
+  // 探索を終えたワーカーには次の部分木を割り当てる
+  // --------------------------------------------------
+  int alpha = -INT_MAX;
+  bitboard_t best = moves[0].mv;
+  bool released = false;
+  uint64_t total_nodes = 0;
+  size_t ndone = 0;
+  while (ndone < moves.size()) {
+    // 空いているワーカーに割り当て
+    bool running = false;
+    for (int i = 0; i < nworkers; i++) {
+      if (worker_fd[i] < 0) continue;
+      if (worker_job[i] < 0) {
+        assign_job(i, jobs, moves, alpha, released);
+      }
+      running |= worker_job[i] >= 0;
+    }
+    // 全ワーカーが落ちたら1プロセスで探索する
+    if (!running) {
+      fprintf(stderr, "ワーカーがいないので1プロセスで探索します\n");
+      return get_csar_move(s, board);
+    }
+    // 結果を待つ
+    struct pollfd pfd[MAX_WORKERS];
+    for (int i = 0; i < nworkers; i++) {
+      pfd[i].fd = worker_fd[i];
+      pfd[i].events = POLLIN;
+      pfd[i].revents = 0;
+    }
+    if (poll(pfd, nworkers, -1) < 0) continue;
+    for (int i = 0; i < nworkers; i++) {
+      if (pfd[i].revents == 0) continue;
+      dist_msg_t msg;
+      if (!recv_msg(worker_fd[i], &msg)) {
+        // 接続が切れたら担当の部分木を割り当て直す
+        close(worker_fd[i]);
+        worker_fd[i] = -1;
+        if (worker_job[i] >= 0) jobs[worker_job[i]].worker = -1;
+        worker_job[i] = -1;
+        continue;
+      }
+      if (msg.type != MSG_RESULT) continue;
+      worker_job[i] = -1;
+      total_nodes += msg.nodes;
+      job_t *job = &jobs[msg.id];
+      root_move_t *move = &moves[job->move];
+      job->worker = -2;
+      if (move->done) continue;
+      move->pending--;
+      // ルートから見た評価値と探索窓
+      int v  = job->sign > 0 ? msg.score : -msg.score;
+      int hi = job->sign > 0 ? msg.beta  : -msg.alpha;
+      // 窓の上限以上なら応手の最小値は変わらない
+      // それ以外は正確な値かalpha以下の上限値
+      if (v < hi && v < move->upper) {
+        move->upper = v;
+      }
+      // alpha以下が確定したか，全応手を調べたら指し手は確定
+      if (move->upper <= alpha || move->pending == 0) {
+        move->done = true;
+        ndone++;
+        if (alpha < move->upper) {
+          alpha = move->upper;
+          best = move->mv;
+        }
+        if (job->move == 0) released = true;
+      }
+    }
+    // alphaを超えられないことが分かった指し手も確定
+    for (size_t m = 0; m < moves.size(); m++) {
+      if (!moves[m].done && moves[m].upper <= alpha) {
+        moves[m].done = true;
+        ndone++;
+      }
+    }
+    // 窓が狭くなった部分木に知らせる
+    update_bounds(jobs, moves, alpha);
+  }
+  // 確定した指し手の部分木を探索中のワーカーを止める
+  drain_workers();
+
+  // 全ワーカーの合計の探索速度
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  fprintf(stderr, "%llu nodes, %.2f sec, %.0f nps\n",
+          (unsigned long long)total_nodes, sec, sec > 0 ? total_nodes / sec : 0);
+  return best;
+}
+
+// ==================================================
+// 探索中のワーカーを打ち切って結果を捨てる
+// 指し手が確定しても部分木の探索は続いているので
+// そのまま戻るとその結果が次の局面の探索に届いてしまう
+// 窓を閉じて打ち切らせ，結果を受け取ってから戻る
+// ==================================================
+void drain_workers() {
+  dist_msg_t msg;
+  for (int i = 0; i < nworkers; i++) {
+    if (worker_fd[i] < 0 || worker_job[i] < 0) continue;
+    memset(&msg, 0, sizeof(msg));
+    msg.type  = MSG_BOUND;
+    msg.id    = worker_job[i];
+    msg.alpha = INT_MAX;
+    msg.beta  = -INT_MAX;
+    send_msg(worker_fd[i], &msg);
+  }
+  for (int i = 0; i < nworkers; i++) {
+    while (worker_fd[i] >= 0 && worker_job[i] >= 0) {
+      if (!recv_msg(worker_fd[i], &msg)) {
+        close(worker_fd[i]);
+        worker_fd[i] = -1;
+      } else if (msg.type == MSG_RESULT) {
+        worker_job[i] = -1;
+      }
+    }
+  }
+}
+
+// ==================================================
+// ワーカーとして探索を請け負う
+// コーディネータとの接続が切れるかQUITを受けたら終了
+// ==================================================
+int run_worker(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return 1;
+  }
+  strcpy(addr.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "コーディネータに接続できません: %s\n", path);
+    return 1;
+  }
+  search_t *s = create_search();
+  s->watch_fd = fd;
+  dist_msg_t msg;
+  bool quit = false;
+  while (!quit && recv_msg(fd, &msg)) {
+    if (msg.type == MSG_QUIT) break;
+    if (msg.type != MSG_JOB) continue;
+    // 局面の復元
+    board_t board;
+    board.player = (player_t)msg.player;
+    board.status = TURN;
+    board.black  = msg.black;
+    board.white  = msg.white;
+    board.nblack = count_of_discs(board.black);
+    board.nwhite = count_of_discs(board.white);
+    board.legal_moves = get_legal_moves(&board);
+    // 探索して結果を返す
+    s->nodes = 0;
+    msg.score = search_job(s, fd, &msg, &board, &quit);
+    msg.type  = MSG_RESULT;
+    msg.nodes = s->nodes;
+    if (!send_msg(fd, &msg)) break;
+  }
+  close(fd);
+  destroy_search(s);
+  return 0;
+}
+
+// ==================================================
+// 部分木を探索する
+// 指し手ごとにコーディネータからの窓の更新を確認する
+// 探索中もコーディネータからメッセージが届くと探索が止まるので
+// 窓を更新して続けるか，窓が閉じていれば打ち切る
+// 最後に使った窓をmsgのalphaとbetaに格納する
+// ==================================================
+int search_job(search_t *s, int fd, dist_msg_t *msg, board_t *board, bool *quit) {
+  int score, alpha = msg->alpha;
+  s->stopped = false;
+  // パスの局面はそのまま探索
+  if (board->legal_moves == 0) {
+    score = nega_max_search(s, board, msg->depth, msg->alpha, msg->beta, false);
+    if (!continue_job(s, fd, msg, &alpha, false, &score, quit)) {
+      return alpha;
+    }
+    return score;
+  }
+  board_t backup = *board;
+  bitboard_t mv, pos = 0x8000000000000000;
+  for (; pos != 0; pos = pos >> 1) {
+    mv = (board->legal_moves & pos);
+    if (mv == 0) continue;
+    // 窓の更新を確認して窓が閉じたら打ち切り
+    poll_bounds(fd, msg->id, &msg->alpha, &msg->beta, quit);
+    if (alpha < msg->alpha) alpha = msg->alpha;
+    if (*quit || msg->beta <= alpha) break;
+    // 着手して次の深さを探索
+    next_turn(board, mv);
+    score = nega_max_search(s, board, msg->depth-1, -msg->beta, -alpha, false);
+    *board = backup;
+    if (!continue_job(s, fd, msg, &alpha, true, &score, quit)) {
+      break;
+    }
+    score = -score;
+    if (alpha < score) {
+      alpha = score;
+    }
+    if (msg->beta <= alpha) {
+      break;
+    }
+  }
+  return alpha;
+}
+
+// ==================================================
+// 止まった探索を窓を更新しながら続ける
+// 探索スタックの一番下のノードは部分木の局面そのもの(negateがfalse)か
+// その子局面(negateがtrue)で，評価値をscoreに格納する
+// 窓が閉じたかQUITを受けたら打ち切ってfalseを返す
+// 窓が狭くなっていれば一番下のノードの窓も狭めてから続ける
+// 上げた下限より良い手がなければ上限値になるようにalpha_origも上げる
+// ==================================================
+bool continue_job(search_t *s, int fd, dist_msg_t *msg, int *alpha, bool negate, int *score, bool *quit) {
+  while (s->stopped) {
+    poll_bounds(fd, msg->id, &msg->alpha, &msg->beta, quit);
+    if (*alpha < msg->alpha) *alpha = msg->alpha;
+    if (*quit || msg->beta <= *alpha) {
+      s->stopped = false;
+      return false;
+    }
+    node_t *n = &s->stack[0];
+    int lo = negate ? -msg->beta : *alpha;
+    int hi = negate ? -*alpha : msg->beta;
+    if (n->alpha < lo) n->alpha = lo;
+    if (n->alpha_orig < lo) n->alpha_orig = lo;
+    if (hi < n->beta) n->beta = hi;
+    *score = resume_search(s);
+  }
+  return true;
+}
+
+// ==================================================
+// 探索窓の更新を受け取る
+// 届いているメッセージだけを読んで待たずに戻る
+// ==================================================
+void poll_bounds(int fd, int id, int *alpha, int *beta, bool *quit) {
+  struct pollfd pfd = {fd, POLLIN, 0};
+  dist_msg_t msg;
+  while (poll(&pfd, 1, 0) > 0) {
+    if (!recv_msg(fd, &msg) || msg.type == MSG_QUIT) {
+      *quit = true;
+      return;
+    }
+    if (msg.type != MSG_BOUND || msg.id != id) continue;
+    if (*alpha < msg.alpha) *alpha = msg.alpha;
+    if (msg.beta < *beta) *beta = msg.beta;
+  }
+}
@@ -0,0 +1,16 @@
+// ==================================================
+// dist.hpp
+// 分散探索のヘッダファイル
+// ==================================================
+
+// --------------------------------------------------
+// 関数のプロトタイプ宣言(dist.cpp)
+// --------------------------------------------------
+// コーディネータを開始してワーカーの接続を待つ
+bool start_coordinator(const char*, int, const char*);
+// コーディネータを終了してワーカーを停止する
+void stop_coordinator();
+// ワーカーで分散探索してAIの手を取得する
+bitboard_t get_dist_move(search_t*, board_t*);
+// ワーカーとして探索を請け負う
+int run_worker(const char*);
@@ -5,9 +5,15 @@
 #include "head.hpp"
 #include "eval.hpp"
 
+// --------------------------------------------------
+// 確定石1つあたりの重み
+// --------------------------------------------------
+#define STABLE_WEIGHT 10
+
 // --------------------------------------------------
 // 関数のプロトタイプ宣言
 // --------------------------------------------------
+// 石差
 int diff_discs(board_t*);
 // 盤面の重み付け法
 int cell_weight(board_t*);
@@ -18,8 +24,59 @@ int get_weight(bitboard_t);
 // 評価関数
 // ==================================================
 int evaluate(board_t *board) {
+#ifdef EVAL_DIFF_DISCS
   return diff_discs(board);
-  // return cell_weight(board);
+#else
+  return cell_weight(board) + stable_discs(board) * STABLE_WEIGHT;
+#endif
+}
+
+// ==================================================
+// 複数の局面をまとめて評価する
+// 局面は手番側の石(own)と相手の石(opp)の配列で渡し
+// 評価値はscoresに手番側から見た値を格納する
+// ==================================================
+void evaluate_batch(const bitboard_t *own, const bitboard_t *opp, int n, int *scores) {
+#ifdef EVAL_DIFF_DISCS
+  diff_discs_batch(own, opp, n, scores);
+#else
+  // 手番側を黒とした盤面を作って1局面ずつ評価する
+  board_t board;
+  board.player = BLACK;
+  for (int i = 0; i < n; i++) {
+    board.black = own[i];
+    board.white = opp[i];
+    scores[i] = evaluate(&board);
+  }
+#endif
+}
+
+// ==================================================
+// 終局した局面の石差
+// 評価関数によらず読み切りの葉と終局はこれで評価する
+// 空きマスが残って終局したら空きマスは勝った方に数える
+// (FFOなどで公表されている最終石差と同じ数え方)
+// ==================================================
+int final_score(board_t *board) {
+  int own = count_of_discs(get_own_bb(board));
+  int opp = count_of_discs(get_opp_bb(board));
+  int empties = 64 - own - opp;
+  if (own > opp) return own - opp + empties;
+  if (own < opp) return own - opp - empties;
+  return 0;
+}
+
+// ==================================================
+// 複数の局面の石差をまとめて求める
+// 石の数をまとめて数えて引くだけ
+// ==================================================
+void diff_discs_batch(const bitboard_t *own, const bitboard_t *opp, int n, int *scores) {
+  int nopp[EVAL_BATCH_MAX];
+  count_of_discs_batch(own, n, scores);
+  count_of_discs_batch(opp, n, nopp);
+  for (int i = 0; i < n; i++) {
+    scores[i] -= nopp[i];
+  }
 }
 
 // ==================================================
@@ -35,6 +92,16 @@ int diff_discs(board_t *board) {
   }
 }
 
+// ==================================================
+// 評価値 = "自分の確定石の数 - 相手の確定石の数"
+// ==================================================
+int stable_discs(board_t *board) {
+  bitboard_t own = get_own_bb(board);
+  bitboard_t opp = get_opp_bb(board);
+  return count_of_discs(get_stable_discs(own, opp))
+       - count_of_discs(get_stable_discs(opp, own));
+}
+
 // ==================================================
 // 盤面の重み付け法
 // ==================================================
@@ -3,8 +3,29 @@
 // 評価関数のヘッダファイル
 // ==================================================
 
+// --------------------------------------------------
+// 評価関数が石差(diff_discs)であることを示す
+// 確定石による枝刈りは石差評価のときのみ有効なので
+// 別の評価関数を使う場合はこの定義を外すこと
+// --------------------------------------------------
+#define EVAL_DIFF_DISCS
+
+// --------------------------------------------------
+// まとめて評価できる局面の最大数
+// 1局面の合法手の数はこれを超えない
+// --------------------------------------------------
+#define EVAL_BATCH_MAX 64
+
 // --------------------------------------------------
 // 関数のプロトタイプ宣言(eval.cpp)
 // --------------------------------------------------
 // 評価関数
 int evaluate(board_t*);
+// 複数の局面をまとめて評価する
+void evaluate_batch(const bitboard_t*, const bitboard_t*, int, int*);
+// 終局した局面の石差
+int final_score(board_t*);
+// 複数の局面の石差をまとめて求める
+void diff_discs_batch(const bitboard_t*, const bitboard_t*, int, int*);
+// 確定石の数の差
+int stable_discs(board_t*);
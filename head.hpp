@@ -45,6 +45,16 @@ typedef struct {
   bitboard_t legal_moves; //現在の局面の合法手
 } board_t;
 
+// --------------------------------------------------
+// 盤面処理のカーネルの命令セット
+// --------------------------------------------------
+typedef enum {
+  ISA_AUTO, //実行中のCPUで使える最速のもの
+  ISA_BASE, //基本命令セット(x86-64)
+  ISA_BMI2, //POPCNT+BMI2
+  ISA_AVX2, //AVX2
+} isa_t;
+
 // --------------------------------------------------
 // 関数のプロトタイプ宣言(proc.cpp)
 // --------------------------------------------------
@@ -64,6 +74,16 @@ bitboard_t get_opp_bb(board_t*);
 bitboard_t get_legal_moves(board_t*);
 // 反転する石の場所を取得する
 bitboard_t get_flip_pattern(board_t*, bitboard_t);
+// 複数のビットボードの石の数をまとめて数える
+void count_of_discs_batch(const bitboard_t*, int, int*);
+// 確定石の場所を取得する
+bitboard_t get_stable_discs(bitboard_t, bitboard_t);
+// 命令セットが実行中のCPUで使えるかどうか
+bool isa_supported(isa_t);
+// 使用するカーネルの命令セットを選択する
+bool select_isa(isa_t);
+// 選択されている命令セットを取得する
+isa_t get_isa();
 
 // --------------------------------------------------
 // 関数のプロトタイプ宣言(disp.cpp)
@@ -76,5 +96,7 @@ void display_legal_moves(bitboard_t);
 void display_csar_move(bitboard_t);
 // 盤面の座標からビットボードへ変換する
 bitboard_t cr_to_bb(int, int);
+// 文字列から局面を読み込む
+bool parse_board(const char*, char, board_t*);
 // プレイヤーの入力を取得する
 bitboard_t get_player_move(board_t*);
@@ -2,14 +2,105 @@
 // main.cpp
 // メイン処理を定義する
 // **************************************************
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include "head.hpp"
 #include "csar.hpp"
+#include "dist.hpp"
+#include "server.hpp"
+
+// --------------------------------------------------
+// 関数のプロトタイプ宣言
+// --------------------------------------------------
+// 局面を最終石差まで読み切る
+int analyze(search_t*, const char*);
 
 // ==================================================
 // プログラムメイン
+// -t file  置換表ファイル(起動時に読み込み終了時に保存)
+// -d depth 置換表ファイルに保存する最小の残り深さ
+// -m size  置換表の大きさ(MB)
+// -i isa   カーネルの命令セットを固定する(base, bmi2, avx2)
+// -s path  分散探索のソケット(コーディネータとして動く)
+// -n num   ワーカー数(分散探索のプロセス数，対局サーバのスレッド数)
+// -w path  分散探索のワーカーとして動く
+// -g path  対局サーバとして動く
+// -a pos   局面(64文字の盤面と手番)を読み切って終了する
+// -c file  読み切りのチェックポイントファイル(あれば続きから読む)
 // ==================================================
-int main() {
+int main(int argc, char *argv[]) {
+  // オプションの解析
+  const char *tt_path = NULL;
+  int tt_depth = 0;
+  int tt_size = TT_SIZE_MB;
+  const char *isa_name = NULL;
+  const char *dist_path = NULL;
+  const char *worker_path = NULL;
+  const char *server_path = NULL;
+  const char *analyze_pos = NULL;
+  const char *cp_path = NULL;
+  int nworkers = 2;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:d:m:i:s:n:w:g:a:c:")) != -1) {
+    switch (opt) {
+      case 't': tt_path  = optarg;       break;
+      case 'd': tt_depth = atoi(optarg); break;
+      case 'm': tt_size  = atoi(optarg); break;
+      case 'i': isa_name = optarg;       break;
+      case 's': dist_path = optarg;      break;
+      case 'n': nworkers = atoi(optarg); break;
+      case 'w': worker_path = optarg;    break;
+      case 'g': server_path = optarg;    break;
+      case 'a': analyze_pos = optarg;    break;
+      case 'c': cp_path = optarg;        break;
+      default:
+        fprintf(stderr, "usage: %s [-t file] [-d depth] [-m size] [-i base|bmi2|avx2] [-s path] [-n num] [-w path] [-g path] [-a pos] [-c file]\n", argv[0]);
+        return 1;
+    }
+  }
+  // カーネルの命令セットを選択
+  isa_t isa = ISA_AUTO;
+  if (isa_name != NULL) {
+    if (strcmp(isa_name, "base") == 0) isa = ISA_BASE;
+    if (strcmp(isa_name, "bmi2") == 0) isa = ISA_BMI2;
+    if (strcmp(isa_name, "avx2") == 0) isa = ISA_AVX2;
+  }
+  if ((isa_name != NULL && isa == ISA_AUTO) || !select_isa(isa)) {
+    fprintf(stderr, "この命令セットは使えません: %s\n", isa_name);
+    return 1;
+  }
+  // ワーカーとして動く
+  if (worker_path != NULL) {
+    return run_worker(worker_path);
+  }
+  // 対局サーバとして動く
+  if (server_path != NULL) {
+    return run_server(server_path, nworkers);
+  }
+  // 分散探索のワーカーを起動
+  if (dist_path != NULL && !start_coordinator(dist_path, nworkers, argv[0])) {
+    fprintf(stderr, "ワーカーを起動できませんでした: %s\n", dist_path);
+    return 1;
+  }
+  // 探索コンテキストの生成と置換表の読み込み
+  search_t *search = create_search();
+  if (tt_size != TT_SIZE_MB && (tt_size < 1 || !resize_tt(search, tt_size))) {
+    fprintf(stderr, "置換表を確保できませんでした: %d MB\n", tt_size);
+    destroy_search(search);
+    return 1;
+  }
+  if (tt_path != NULL) {
+    load_tt(search, tt_path);
+  }
+  // 局面を読み切って終了する
+  if (analyze_pos != NULL) {
+    search->checkpoint = cp_path;
+    int ret = analyze(search, analyze_pos);
+    destroy_search(search);
+    return ret;
+  }
+
   board_t board;
   initialize(&board);
 
@@ -23,7 +114,7 @@ int main() {
     } else {
       printf("AI 考え中...");
       fflush(stdout);
-      mv = get_csar_move(&board);
+      mv = dist_path != NULL ? get_dist_move(search, &board) : get_csar_move(search, &board);
       sleep(1); //1秒は待つ
       printf(" > ");
       display_csar_move(mv);
@@ -43,6 +134,44 @@ int main() {
   if (board.nblack <  board.nwhite) printf("白の勝ち！\n");
   if (board.nblack == board.nwhite) printf("引き分け．\n");
 
+  // 分散探索のワーカーを停止
+  if (dist_path != NULL) {
+    stop_coordinator();
+  }
+
+  // 置換表の保存
+  if (tt_path != NULL && !save_tt(search, tt_path, tt_depth)) {
+    fprintf(stderr, "置換表を保存できませんでした: %s\n", tt_path);
+  }
+  destroy_search(search);
+
   return 0;
 }
 
+
+// ==================================================
+// 局面を最終石差まで読み切る
+// posは盤面の64文字の後ろに空白を挟んで手番(XかO)を書く
+// ==================================================
+int analyze(search_t *s, const char *pos) {
+  size_t len = strlen(pos);
+  board_t board;
+  if (len < 65 || !parse_board(pos, pos[len-1], &board)) {
+    fprintf(stderr, "局面を読み込めませんでした: %s\n", pos);
+    return 1;
+  }
+  if (board.status == OVER) {
+    fprintf(stderr, "終局した局面です: %s\n", pos);
+    return 1;
+  }
+  display(&board);
+  s->wld_empties = s->exact_empties = 64;
+  set_position(s, &board);
+  int64_t start = now_msec();
+  int score = search(s);
+  int64_t msec = now_msec() - start;
+  printf("石差 %+d  最善手 ", score);
+  display_csar_move(s->best_move);
+  printf("%llu ノード %lld ms\n", (unsigned long long)s->nodes, (long long)msec);
+  return 0;
+}
@@ -20,7 +20,7 @@ void initialize(board_t *board) {
 // 石の数を数える
 // 分割統治法による高速ビットカウント
 // ==================================================
-int count_of_discs(bitboard_t bitboard) {
+static int count_of_discs_base(bitboard_t bitboard) {
   bitboard_t bb = bitboard;
   bb = (bb & 0x5555555555555555) + ((bb & 0xaaaaaaaaaaaaaaaa) >>  1);
   bb = (bb & 0x3333333333333333) + ((bb & 0xcccccccccccccccc) >>  2);
@@ -96,11 +96,11 @@ bitboard_t get_opp_bb(board_t *board) {
 
 // ==================================================
 // 合法手の一覧を生成する
+// 各命令セット版の共通の処理なので必ずインライン展開する
 // ==================================================
-bitboard_t get_legal_moves(board_t *board) {
+static inline __attribute__((always_inline))
+bitboard_t legal_moves_generic(bitboard_t own, bitboard_t opp) {
   bitboard_t t, mask, legal_moves = 0;
-  bitboard_t own = get_own_bb(board);
-  bitboard_t opp = get_opp_bb(board);
 
   // 空マスを取得
   // 黒石と白石の場所のNOTで取得
@@ -215,11 +215,11 @@ bitboard_t get_legal_moves(board_t *board) {
 // ==================================================
 // 反転する石の場所を取得する
 // 引数のmvは着手箇所(1ビットのみが1で他はすべて0)
+// 各命令セット版の共通の処理なので必ずインライン展開する
 // ==================================================
-bitboard_t get_flip_pattern(board_t *board, bitboard_t mv) {
+static inline __attribute__((always_inline))
+bitboard_t flip_pattern_generic(bitboard_t own, bitboard_t opp, bitboard_t mv) {
   bitboard_t temp, mask, flip = 0;
-  bitboard_t own = get_own_bb(board);
-  bitboard_t opp = get_opp_bb(board);
 
   // 着手箇所が空マスで無いなら終了(通常はありえない)
   if (((own | opp) & mv) != 0) {
@@ -340,3 +340,334 @@ bitboard_t get_flip_pattern(board_t *board, bitboard_t mv) {
 
   return flip;
 }
+
+// ==================================================
+// 基本命令セット(x86-64)版
+// ==================================================
+static bitboard_t legal_moves_base(bitboard_t own, bitboard_t opp) {
+  return legal_moves_generic(own, opp);
+}
+
+static bitboard_t flip_pattern_base(bitboard_t own, bitboard_t opp, bitboard_t mv) {
+  return flip_pattern_generic(own, opp, mv);
+}
+
+static void count_of_discs_batch_base(const bitboard_t *bb, int n, int *count) {
+  for (int i = 0; i < n; i++) {
+    count[i] = count_of_discs_base(bb[i]);
+  }
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// ==================================================
+// POPCNT+BMI2版
+// ビットカウントはPOPCNT命令1つで済む
+// 他の処理は同じコードをBMI2有効でコンパイルしたもの
+// ==================================================
+__attribute__((target("popcnt,bmi2")))
+static int count_of_discs_bmi2(bitboard_t bitboard) {
+  return __builtin_popcountll(bitboard);
+}
+
+__attribute__((target("popcnt,bmi2")))
+static bitboard_t legal_moves_bmi2(bitboard_t own, bitboard_t opp) {
+  return legal_moves_generic(own, opp);
+}
+
+__attribute__((target("popcnt,bmi2")))
+static bitboard_t flip_pattern_bmi2(bitboard_t own, bitboard_t opp, bitboard_t mv) {
+  return flip_pattern_generic(own, opp, mv);
+}
+
+__attribute__((target("popcnt,bmi2")))
+static void count_of_discs_batch_bmi2(const bitboard_t *bb, int n, int *count) {
+  for (int i = 0; i < n; i++) {
+    count[i] = __builtin_popcountll(bb[i]);
+  }
+}
+
+// --------------------------------------------------
+// AVX2版で使う4方向分のシフト量とマスク
+// 横，縦，左上-右下，右上-左下の順に並べる
+// マスクの意味は基本版の各方向の処理と同じ
+// --------------------------------------------------
+#define AVX2_SHIFT _mm256_set_epi64x(7, 9, 8, 1)
+#define AVX2_MASK  _mm256_set_epi64x(0x007e7e7e7e7e7e00, 0x007e7e7e7e7e7e00, \
+                                     0x00ffffffffffff00, 0x7e7e7e7e7e7e7e7e)
+
+// ==================================================
+// 256ビットレジスタの4つの値のORをとる
+// ==================================================
+__attribute__((target("avx2")))
+static inline bitboard_t or_reduce(__m256i v) {
+  __m128i x = _mm_or_si128(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  x = _mm_or_si128(x, _mm_unpackhi_epi64(x, x));
+  return (bitboard_t)_mm_cvtsi128_si64(x);
+}
+
+// ==================================================
+// AVX2版の合法手生成
+// 4方向をまとめて左右にシフトする
+// ==================================================
+__attribute__((target("popcnt,bmi2,avx2")))
+static bitboard_t legal_moves_avx2(bitboard_t own, bitboard_t opp) {
+  __m256i shift = AVX2_SHIFT;
+  __m256i mask  = _mm256_and_si256(_mm256_set1_epi64x(opp), AVX2_MASK);
+  __m256i p     = _mm256_set1_epi64x(own);
+  // 自石から連続する他石を調べる(反転可能な石は最大6つ)
+  __m256i l = _mm256_and_si256(mask, _mm256_sllv_epi64(p, shift));
+  __m256i r = _mm256_and_si256(mask, _mm256_srlv_epi64(p, shift));
+  for (int i = 0; i < 5; i++) {
+    l = _mm256_or_si256(l, _mm256_and_si256(mask, _mm256_sllv_epi64(l, shift)));
+    r = _mm256_or_si256(r, _mm256_and_si256(mask, _mm256_srlv_epi64(r, shift)));
+  }
+  // 連続する他石の隣の空マスが合法手
+  __m256i moves = _mm256_or_si256(_mm256_sllv_epi64(l, shift), _mm256_srlv_epi64(r, shift));
+  return or_reduce(moves) & ~(own | opp);
+}
+
+// ==================================================
+// AVX2版の反転パターン取得
+// 着手箇所から連続する他石を4方向まとめて調べ
+// その先に自石がある方向だけ反転させる
+// ==================================================
+__attribute__((target("popcnt,bmi2,avx2")))
+static bitboard_t flip_pattern_avx2(bitboard_t own, bitboard_t opp, bitboard_t mv) {
+  // 着手箇所が空マスで無いなら終了(通常はありえない)
+  if (((own | opp) & mv) != 0) {
+    return 0;
+  }
+  __m256i shift = AVX2_SHIFT;
+  __m256i mask  = _mm256_and_si256(_mm256_set1_epi64x(opp), AVX2_MASK);
+  __m256i p     = _mm256_set1_epi64x(own);
+  __m256i m     = _mm256_set1_epi64x(mv);
+  __m256i zero  = _mm256_setzero_si256();
+  // 着手箇所から連続する他石
+  __m256i l = _mm256_and_si256(mask, _mm256_sllv_epi64(m, shift));
+  __m256i r = _mm256_and_si256(mask, _mm256_srlv_epi64(m, shift));
+  for (int i = 0; i < 5; i++) {
+    l = _mm256_or_si256(l, _mm256_and_si256(mask, _mm256_sllv_epi64(l, shift)));
+    r = _mm256_or_si256(r, _mm256_and_si256(mask, _mm256_srlv_epi64(r, shift)));
+  }
+  // 連続する他石の先が自石でない方向は反転しない
+  __m256i l_end = _mm256_and_si256(p, _mm256_sllv_epi64(l, shift));
+  __m256i r_end = _mm256_and_si256(p, _mm256_srlv_epi64(r, shift));
+  l = _mm256_andnot_si256(_mm256_cmpeq_epi64(l_end, zero), l);
+  r = _mm256_andnot_si256(_mm256_cmpeq_epi64(r_end, zero), r);
+  return or_reduce(_mm256_or_si256(l, r));
+}
+
+// ==================================================
+// AVX2版のまとめてビットカウント
+// 4ビットごとの石の数を表引き(VPSHUFB)で求めて
+// バイトごとの和(VPSADBW)で64ビットずつに集める
+// ==================================================
+__attribute__((target("popcnt,bmi2,avx2")))
+static void count_of_discs_batch_avx2(const bitboard_t *bb, int n, int *count) {
+  const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i v  = _mm256_loadu_si256((const __m256i*)(bb + i));
+    __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, low));
+    __m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+    __m256i c  = _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+    // 4つの64ビットの和を32ビット整数4つに詰める
+    __m128i packed = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(c, _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0)));
+    _mm_storeu_si128((__m128i*)(count + i), packed);
+  }
+  for (; i < n; i++) {
+    count[i] = __builtin_popcountll(bb[i]);
+  }
+}
+#endif
+
+// --------------------------------------------------
+// 実行時に選択されたカーネル
+// 起動時にselect_isaで選び直すまでは基本版を使う
+// --------------------------------------------------
+static isa_t isa = ISA_BASE;
+static int (*count_of_discs_impl)(bitboard_t) = count_of_discs_base;
+static bitboard_t (*legal_moves_impl)(bitboard_t, bitboard_t) = legal_moves_base;
+static bitboard_t (*flip_pattern_impl)(bitboard_t, bitboard_t, bitboard_t) = flip_pattern_base;
+static void (*count_of_discs_batch_impl)(const bitboard_t*, int, int*) = count_of_discs_batch_base;
+
+// ==================================================
+// 命令セットが実行中のCPUで使えるかどうか
+// ==================================================
+bool isa_supported(isa_t target) {
+  switch (target) {
+    case ISA_AUTO:
+    case ISA_BASE:
+      return true;
+#if defined(__x86_64__)
+    case ISA_BMI2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("popcnt") && __builtin_cpu_supports("bmi2");
+    case ISA_AVX2:
+      return isa_supported(ISA_BMI2) && __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+// ==================================================
+// 使用するカーネルの命令セットを選択する
+// ISA_AUTOならCPUIDを調べて使える中で最も速いものを選ぶ
+// 使えない命令セットが指定されたらfalseを返す
+// ==================================================
+bool select_isa(isa_t target) {
+  if (target == ISA_AUTO) {
+    target = isa_supported(ISA_AVX2) ? ISA_AVX2
+           : isa_supported(ISA_BMI2) ? ISA_BMI2
+           : ISA_BASE;
+  }
+  if (!isa_supported(target)) {
+    return false;
+  }
+  switch (target) {
+#if defined(__x86_64__)
+    case ISA_AVX2:
+      count_of_discs_impl = count_of_discs_bmi2;
+      legal_moves_impl    = legal_moves_avx2;
+      flip_pattern_impl   = flip_pattern_avx2;
+      count_of_discs_batch_impl = count_of_discs_batch_avx2;
+      break;
+    case ISA_BMI2:
+      count_of_discs_impl = count_of_discs_bmi2;
+      legal_moves_impl    = legal_moves_bmi2;
+      flip_pattern_impl   = flip_pattern_bmi2;
+      count_of_discs_batch_impl = count_of_discs_batch_bmi2;
+      break;
+#endif
+    default:
+      count_of_discs_impl = count_of_discs_base;
+      legal_moves_impl    = legal_moves_base;
+      flip_pattern_impl   = flip_pattern_base;
+      count_of_discs_batch_impl = count_of_discs_batch_base;
+      break;
+  }
+  isa = target;
+  return true;
+}
+
+// ==================================================
+// 選択されている命令セットを取得する
+// ==================================================
+isa_t get_isa() {
+  return isa;
+}
+
+// ==================================================
+// 石の数を数える
+// ==================================================
+int count_of_discs(bitboard_t bitboard) {
+  return count_of_discs_impl(bitboard);
+}
+
+// ==================================================
+// 複数のビットボードの石の数をまとめて数える
+// ==================================================
+void count_of_discs_batch(const bitboard_t *bb, int n, int *count) {
+  count_of_discs_batch_impl(bb, n, count);
+}
+
+// ==================================================
+// 合法手の一覧を生成する
+// ==================================================
+bitboard_t get_legal_moves(board_t *board) {
+  return legal_moves_impl(get_own_bb(board), get_opp_bb(board));
+}
+
+// ==================================================
+// 反転する石の場所を取得する
+// 引数のmvは着手箇所(1ビットのみが1で他はすべて0)
+// ==================================================
+bitboard_t get_flip_pattern(board_t *board, bitboard_t mv) {
+  return flip_pattern_impl(get_own_bb(board), get_opp_bb(board), mv);
+}
+
+// --------------------------------------------------
+// 斜め方向のライン(右下がり)
+// --------------------------------------------------
+const bitboard_t DIAG_DOWN[15] = {
+  0x0100000000000000, 0x0201000000000000, 0x0402010000000000,
+  0x0804020100000000, 0x1008040201000000, 0x2010080402010000,
+  0x4020100804020100, 0x8040201008040201, 0x0080402010080402,
+  0x0000804020100804, 0x0000008040201008, 0x0000000080402010,
+  0x0000000000804020, 0x0000000000008040, 0x0000000000000080,
+};
+
+// --------------------------------------------------
+// 斜め方向のライン(右上がり)
+// --------------------------------------------------
+const bitboard_t DIAG_UP[15] = {
+  0x8000000000000000, 0x4080000000000000, 0x2040800000000000,
+  0x1020408000000000, 0x0810204080000000, 0x0408102040800000,
+  0x0204081020408000, 0x0102040810204080, 0x0001020408102040,
+  0x0000010204081020, 0x0000000102040810, 0x0000000001020408,
+  0x0000000000010204, 0x0000000000000102, 0x0000000000000001,
+};
+
+// ==================================================
+// 確定石(二度と反転しない石)の場所を取得する
+// ownの確定石の下限を求める(すべての確定石を
+// 求めるわけではないが，求めた石は必ず確定石)
+// ==================================================
+bitboard_t get_stable_discs(bitboard_t own, bitboard_t opp) {
+  bitboard_t t, filled = own | opp;
+
+  // --------------------------------------------------
+  // 埋まっているラインを調べる
+  // 埋まったライン上の石はその方向には反転しない
+  // --------------------------------------------------
+  // 横方向: 各行の8マスのANDを行の右端に集めて行全体へ広げる
+  t  = filled & (filled >> 4);
+  t &= t >> 2;
+  t &= t >> 1;
+  bitboard_t full_h = (t & 0x0101010101010101) * 0xff;
+  // 縦方向: 各列の8マスのANDを最下行に集めて列全体へ広げる
+  t  = filled & (filled >> 32);
+  t &= t >> 16;
+  t &= t >> 8;
+  bitboard_t full_v = (t & 0x00000000000000ff) * 0x0101010101010101;
+  // 斜め方向: ラインごとに調べる
+  bitboard_t full_d = 0, full_u = 0;
+  for (int i = 0; i < 15; i++) {
+    if ((filled & DIAG_DOWN[i]) == DIAG_DOWN[i]) full_d |= DIAG_DOWN[i];
+    if ((filled & DIAG_UP[i])   == DIAG_UP[i])   full_u |= DIAG_UP[i];
+  }
+
+  // --------------------------------------------------
+  // 盤の端は外側からはさまれることがないので
+  // その方向には反転しない
+  // --------------------------------------------------
+  full_h |= 0x8181818181818181;
+  full_v |= 0xff000000000000ff;
+  full_d |= 0xff818181818181ff;
+  full_u |= 0xff818181818181ff;
+
+  // --------------------------------------------------
+  // 4方向すべてで「ラインが埋まっている」か
+  // 「どちらかの隣が自分の確定石」ならその石も確定石
+  // 隅から順に確定石が増えなくなるまで繰り返す
+  // --------------------------------------------------
+  bitboard_t stable = 0, prev;
+  do {
+    prev = stable;
+    bitboard_t h = full_h | ((stable << 1) & 0xfefefefefefefefe)
+                          | ((stable >> 1) & 0x7f7f7f7f7f7f7f7f);
+    bitboard_t v = full_v | (stable << 8) | (stable >> 8);
+    bitboard_t d = full_d | ((stable << 9) & 0xfefefefefefefefe)
+                          | ((stable >> 9) & 0x7f7f7f7f7f7f7f7f);
+    bitboard_t u = full_u | ((stable << 7) & 0x7f7f7f7f7f7f7f7f)
+                          | ((stable >> 7) & 0xfefefefefefefefe);
+    stable |= own & h & v & d & u;
+  } while (stable != prev);
+
+  return stable;
+}
@@ -0,0 +1,499 @@
+// **************************************************
+// server.cpp
+// 対局サーバ
+// 1プロセスで多数の対局を受け持ち
+// AIの着手は固定数のワーカースレッドで計算する
+//
+// プロトコル(1行1コマンド，応答も1行)
+//   new                 → ok <id>          対局を作る
+//   play <id> <a1..h8>  → ok <id> <status> 着手する
+//   ai <id> [msec]      → move <id> <a1..h8> <status>
+//                                          AIが着手する(非同期)
+//   show <id>           → board <id> <black> <white> <player> <status>
+//   end <id>            → ok <id>          対局を終える
+//   stats               → stats sessions=N queue=N p50=Xms p99=Xms
+//   エラーは error <理由>
+// AIの制限時間は正の値でMAX_BUDGETを超えたらMAX_BUDGETにする
+// **************************************************
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "head.hpp"
+#include "csar.hpp"
+#include "server.hpp"
+
+// --------------------------------------------------
+// AIの着手の既定の制限時間(ミリ秒)
+// --------------------------------------------------
+#define DEFAULT_BUDGET 1000
+
+// --------------------------------------------------
+// AIの着手の制限時間の上限(ミリ秒)
+// 0は無制限になるので受け付けず，長すぎる時間もこれで抑える
+// --------------------------------------------------
+#define MAX_BUDGET 60000
+
+// --------------------------------------------------
+// 応答時間の統計に使うサンプル数
+// --------------------------------------------------
+#define LATENCY_SAMPLES 4096
+
+// --------------------------------------------------
+// 1行の最大長
+// --------------------------------------------------
+#define CMD_MAX 256
+
+// --------------------------------------------------
+// クライアントごとの送信待ちの上限(バイト)
+// 応答を読まないクライアントはこれを超えたら
+// 読むまでコマンドを受け付けない
+// --------------------------------------------------
+#define OUT_LIMIT 65536
+
+// --------------------------------------------------
+// AIの着手の依頼
+// --------------------------------------------------
+typedef struct {
+  int session;     //対局の番号
+  int budget;      //制限時間(ミリ秒)
+  int64_t queued;  //依頼を受けた時刻(ミリ秒)
+} request_t;
+
+// --------------------------------------------------
+// クライアントの接続
+// ソケットはノンブロッキングにして応答は送信バッファに溜め
+// 送れなかった分は受け付けスレッドが送れるようになってから送る
+// 応答はワーカーからも送るので送信バッファは排他する
+// --------------------------------------------------
+typedef struct {
+  int fd;                      //ソケット
+  bool closed;                 //切断されたかどうか
+  char buf[CMD_MAX];           //受信途中の行
+  size_t len;                  //受信途中の行の長さ
+  std::mutex send_lock;        //送信バッファの排他
+  std::string out;             //送信待ちの応答
+  std::deque<request_t> queue; //未処理の依頼
+} client_t;
+
+// --------------------------------------------------
+// 対局
+// --------------------------------------------------
+typedef struct {
+  board_t board; //局面
+  int owner;     //対局を作ったクライアントのソケット
+  bool busy;     //AIが考え中かどうか
+} session_t;
+
+// --------------------------------------------------
+// サーバの状態
+// 以下はすべてlockで排他する
+// --------------------------------------------------
+std::mutex lock;
+std::condition_variable cond;
+std::unordered_map<int, session_t> sessions;
+std::unordered_map<int, std::shared_ptr<client_t>> clients;
+// 未処理の依頼があるクライアント
+// 先頭から1件ずつ処理して末尾に回すので
+// 依頼の多いクライアントが他を待たせることはない
+std::deque<std::shared_ptr<client_t>> ready;
+// 受け付けスレッドを起こすパイプ
+// ワーカーが送りきれなかった応答を送らせるのに使う
+int wake_pipe[2];
+int next_session = 1;
+int queued = 0;
+double latency[LATENCY_SAMPLES];
+uint64_t nlatency = 0;
+
+// --------------------------------------------------
+// 関数のプロトタイプ宣言
+// --------------------------------------------------
+// AIの着手を計算するワーカー
+void server_worker();
+// コマンドを処理する
+void handle_command(std::shared_ptr<client_t>, char*);
+// 1行送信する
+void send_line(client_t*, const char*, ...);
+// 送信待ちの応答を送れるだけ送る
+void flush_output(client_t*);
+// 着手箇所を座標の文字列に変換する
+void move_to_str(bitboard_t, char*);
+// ゲームの状態を文字列に変換する
+const char* status_str(board_t*);
+
+// ==================================================
+// 対局サーバを動かす
+// pathのUnixドメインソケットで接続を待ち
+// AIの着手はnthreads個のワーカーで計算する
+// ==================================================
+int run_server(const char *path, int nthreads) {
+  // ワーカーがいないとAIの依頼が処理されない
+  if (nthreads < 1) {
+    fprintf(stderr, "ワーカースレッド数が不正です: %d\n", nthreads);
+    return 1;
+  }
+  // ソケットの作成
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return 1;
+  }
+  strcpy(addr.sun_path, path);
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(path);
+  if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "ソケットを開けません: %s\n", path);
+    return 1;
+  }
+  if (pipe(wake_pipe) != 0) {
+    fprintf(stderr, "パイプを作れません\n");
+    return 1;
+  }
+  fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+  // ワーカーの起動
+  for (int i = 0; i < nthreads; i++) {
+    std::thread(server_worker).detach();
+  }
+  // 接続とコマンドの受け付け
+  // 送信待ちがあれば送れるようになるのも待ち
+  // 送信待ちが溜まりすぎたクライアントからは受信しない
+  std::vector<struct pollfd> pfd;
+  while (true) {
+    pfd.clear();
+    pfd.push_back({listen_fd, POLLIN, 0});
+    pfd.push_back({wake_pipe[0], POLLIN, 0});
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      for (auto &c : clients) {
+        std::lock_guard<std::mutex> send_guard(c.second->send_lock);
+        short events = c.second->out.size() < OUT_LIMIT ? POLLIN : 0;
+        if (!c.second->out.empty()) events |= POLLOUT;
+        pfd.push_back({c.first, events, 0});
+      }
+    }
+    if (poll(pfd.data(), pfd.size(), -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    // 起こされただけならパイプを空にする
+    if (pfd[1].revents != 0) {
+      char dummy[64];
+      while (read(wake_pipe[0], dummy, sizeof(dummy)) > 0);
+    }
+    // 新しい接続
+    if (pfd[0].revents != 0) {
+      int fd = accept(listen_fd, NULL, NULL);
+      if (fd >= 0) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        std::shared_ptr<client_t> c = std::make_shared<client_t>();
+        c->fd = fd;
+        c->closed = false;
+        c->len = 0;
+        std::lock_guard<std::mutex> guard(lock);
+        clients[fd] = c;
+      }
+    }
+    // 応答の送信とコマンドの受信
+    for (size_t i = 2; i < pfd.size(); i++) {
+      if (pfd[i].revents == 0) continue;
+      std::shared_ptr<client_t> c;
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        c = clients[pfd[i].fd];
+      }
+      if (pfd[i].revents & POLLOUT) {
+        std::lock_guard<std::mutex> send_guard(c->send_lock);
+        flush_output(c.get());
+      }
+      if ((pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0) continue;
+      ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len - 1, 0);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+      if (n <= 0) {
+        // 切断されたらそのクライアントの対局を片付ける
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto it = sessions.begin(); it != sessions.end();) {
+          it = it->second.owner == c->fd ? sessions.erase(it) : std::next(it);
+        }
+        queued -= c->queue.size();
+        c->queue.clear();
+        ready.erase(std::remove(ready.begin(), ready.end(), c), ready.end());
+        clients.erase(c->fd);
+        std::lock_guard<std::mutex> send_guard(c->send_lock);
+        c->closed = true;
+        close(c->fd);
+        continue;
+      }
+      c->len += n;
+      c->buf[c->len] = '\0';
+      // 受信した行ごとに処理
+      char *line = c->buf, *eol;
+      while ((eol = strchr(line, '\n')) != NULL) {
+        *eol = '\0';
+        handle_command(c, line);
+        line = eol + 1;
+      }
+      c->len = strlen(line);
+      memmove(c->buf, line, c->len + 1);
+      // 改行のない長すぎる行は捨てる
+      if (c->len >= sizeof(c->buf) - 1) {
+        c->len = 0;
+        send_line(c.get(), "error line too long");
+      }
+    }
+  }
+  close(listen_fd);
+  unlink(path);
+  return 0;
+}
+
+// ==================================================
+// コマンドを処理する
+// ==================================================
+void handle_command(std::shared_ptr<client_t> c, char *line) {
+  char cmd[16], coord[4];
+  int id = 0, budget = DEFAULT_BUDGET;
+  int n = sscanf(line, "%15s %d", cmd, &id);
+  if (n < 1) return;
+  std::lock_guard<std::mutex> guard(lock);
+
+  // 対局を作る
+  if (strcmp(cmd, "new") == 0) {
+    session_t session;
+    initialize(&session.board);
+    session.board.status = TURN;
+    session.owner = c->fd;
+    session.busy = false;
+    id = next_session++;
+    sessions[id] = session;
+    send_line(c.get(), "ok %d", id);
+    return;
+  }
+  // 統計を返す
+  if (strcmp(cmd, "stats") == 0) {
+    size_t count = std::min<uint64_t>(nlatency, LATENCY_SAMPLES);
+    std::vector<double> samples(latency, latency + count);
+    std::sort(samples.begin(), samples.end());
+    double p50 = count > 0 ? samples[count * 50 / 100] : 0;
+    double p99 = count > 0 ? samples[count * 99 / 100] : 0;
+    send_line(c.get(), "stats sessions=%zu queue=%d p50=%.1fms p99=%.1fms",
+              sessions.size(), queued, p50, p99);
+    return;
+  }
+
+  // 以下は対局の番号が必要
+  if (strcmp(cmd, "end") != 0 && strcmp(cmd, "show") != 0 &&
+      strcmp(cmd, "play") != 0 && strcmp(cmd, "ai") != 0) {
+    send_line(c.get(), "error unknown command");
+    return;
+  }
+  auto it = sessions.find(id);
+  if (n < 2 || it == sessions.end() || it->second.owner != c->fd) {
+    send_line(c.get(), "error no such session");
+    return;
+  }
+  session_t *session = &it->second;
+  board_t *board = &session->board;
+
+  // 対局を終える
+  // AIが考え中ならその結果はワーカーが捨てる
+  if (strcmp(cmd, "end") == 0) {
+    sessions.erase(it);
+    send_line(c.get(), "ok %d", id);
+    return;
+  }
+  // 局面を返す(AIが考え中なら着手前の局面)
+  if (strcmp(cmd, "show") == 0) {
+    send_line(c.get(), "board %d %016llx %016llx %s %s", id,
+              (unsigned long long)board->black, (unsigned long long)board->white,
+              board->player == BLACK ? "black" : "white", status_str(board));
+    return;
+  }
+  // 以下は局面を変えるのでAIが考え中なら受け付けない
+  if (session->busy) {
+    send_line(c.get(), "error session busy");
+    return;
+  }
+  // 着手する
+  if (strcmp(cmd, "play") == 0) {
+    if (sscanf(line, "%*s %*d %3s", coord) != 1 ||
+        coord[0] < 'a' || 'h' < coord[0] || coord[1] < '1' || '8' < coord[1]) {
+      send_line(c.get(), "error bad move");
+      return;
+    }
+    bitboard_t mv = cr_to_bb(coord[0] - 'a', coord[1] - '1');
+    if (board->status == OVER || (mv & board->legal_moves) == 0) {
+      send_line(c.get(), "error illegal move");
+      return;
+    }
+    next_turn(board, mv);
+    check_board_status(board);
+    send_line(c.get(), "ok %d %s", id, status_str(board));
+    return;
+  }
+  // AIの着手を依頼する
+  if (strcmp(cmd, "ai") == 0) {
+    if (board->status == OVER) {
+      send_line(c.get(), "error game over");
+      return;
+    }
+    // 0以下は無制限の探索になるので受け付けない
+    sscanf(line, "%*s %*d %d", &budget);
+    if (budget <= 0) {
+      send_line(c.get(), "error bad budget");
+      return;
+    }
+    budget = std::min(budget, MAX_BUDGET);
+    session->busy = true;
+    if (c->queue.empty()) {
+      ready.push_back(c);
+    }
+    c->queue.push_back({id, budget, now_msec()});
+    queued++;
+    cond.notify_one();
+  }
+}
+
+// ==================================================
+// AIの着手を計算するワーカー
+// 探索コンテキストは対局ごとではなくワーカーごとに持ち
+// 置換表は対局をまたいで使い回し
+// 前の探索のエントリから順に置き換わる
+// ==================================================
+void server_worker() {
+  search_t *s = create_search();
+  while (true) {
+    // 依頼を取り出す
+    std::shared_ptr<client_t> c;
+    request_t req;
+    board_t board;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      cond.wait(guard, [] { return !ready.empty(); });
+      c = ready.front();
+      ready.pop_front();
+      req = c->queue.front();
+      c->queue.pop_front();
+      queued--;
+      if (!c->queue.empty()) {
+        ready.push_back(c);
+      }
+      auto it = sessions.find(req.session);
+      if (it == sessions.end()) continue;
+      board = it->second.board;
+    }
+    // 探索
+    s->time_limit = req.budget;
+    bitboard_t mv = get_csar_move(s, &board);
+    // 着手する(考え中に対局が終えられていたら捨てる)
+    const char *status;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      auto it = sessions.find(req.session);
+      if (it == sessions.end()) continue;
+      board_t *b = &it->second.board;
+      next_turn(b, mv);
+      check_board_status(b);
+      it->second.busy = false;
+      status = status_str(b);
+    }
+    // 応答を返す
+    char coord[4];
+    move_to_str(mv, coord);
+    send_line(c.get(), "move %d %s %s", req.session, coord, status);
+    std::lock_guard<std::mutex> guard(lock);
+    latency[nlatency++ % LATENCY_SAMPLES] = (double)(now_msec() - req.queued);
+  }
+}
+
+// ==================================================
+// 1行送信する
+// 送信バッファに追加して送れるだけ送り
+// 残りは受け付けスレッドを起こして送らせる
+// ソケットはノンブロッキングなのでlockを持ったまま呼んでよい
+// ==================================================
+void send_line(client_t *c, const char *format, ...) {
+  char line[CMD_MAX];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(line, sizeof(line) - 1, format, args);
+  va_end(args);
+  if (len < 0) return;
+  if (len > (int)sizeof(line) - 2) len = sizeof(line) - 2;
+  line[len++] = '\n';
+  std::lock_guard<std::mutex> guard(c->send_lock);
+  if (c->closed) return;
+  c->out.append(line, len);
+  flush_output(c);
+  // パイプが一杯なら受け付けスレッドはすでに起こされている
+  if (!c->out.empty()) {
+    write(wake_pipe[1], "", 1);
+  }
+}
+
+// ==================================================
+// 送信待ちの応答を送れるだけ送る
+// 待たずに戻るので呼ぶ前にsend_lockを取っておく
+// 切断されていたら送信待ちは捨てる(後で受信側が片付ける)
+// ==================================================
+void flush_output(client_t *c) {
+  while (!c->out.empty() && !c->closed) {
+    ssize_t n = send(c->fd, c->out.data(), c->out.size(), MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (n <= 0) {
+      c->out.clear();
+      return;
+    }
+    c->out.erase(0, n);
+  }
+}
+
+// ==================================================
+// 着手箇所を座標の文字列に変換する
+// 着手がなければ"--"
+// ==================================================
+void move_to_str(bitboard_t mv, char *str) {
+  bitboard_t pos = 0x8000000000000000;
+  for (int r = 0; r < 8; r++) {
+    for (int c = 0; c < 8; c++) {
+      if ((mv & pos) != 0) {
+        str[0] = 'a' + c;
+        str[1] = '1' + r;
+        str[2] = '\0';
+        return;
+      }
+      pos = pos >> 1;
+    }
+  }
+  strcpy(str, "--");
+}
+
+// ==================================================
+// ゲームの状態を文字列に変換する
+// 着手した側から見た状態なのでPASSは相手がパスしたこと
+// ==================================================
+const char* status_str(board_t *board) {
+  switch (board->status) {
+    case PASS: return "pass";
+    case OVER: return "over";
+    default:   return "turn";
+  }
+}
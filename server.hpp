@@ -0,0 +1,10 @@
+// ==================================================
+// server.hpp
+// 対局サーバのヘッダファイル
+// ==================================================
+
+// --------------------------------------------------
+// 関数のプロトタイプ宣言(server.cpp)
+// --------------------------------------------------
+// 対局サーバを動かす
+int run_server(const char*, int);
@@ -0,0 +1,536 @@
+// **************************************************
+// store.cpp
+// 局面ファイル
+// 学習や定石作成に使う大量の局面を16バイトずつ保存する
+// **************************************************
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "head.hpp"
+#include "store.hpp"
+
+// --------------------------------------------------
+// 局面ファイルの定義
+// ヘッダの後ろにレコードが並ぶ
+// ヘッダも16バイトなのでマップしたレコードは16バイト境界に揃う
+// --------------------------------------------------
+#define STORE_FILE_MAGIC   "CSARPOS" //終端と合わせて8バイト
+#define STORE_FILE_VERSION 1
+#define STORE_SORTED       1 //整列済みで重複がない
+
+typedef struct {
+  char     magic[8]; //ファイルの識別子
+  uint32_t version;  //ファイル形式のバージョン
+  uint32_t flags;    //ファイルの状態
+} store_file_header_t;
+
+// --------------------------------------------------
+// 中央の4マス(d4, e4, d5, e5)
+// oppではd5, e5の2ビットに勝敗を入れ
+// e4のビットは同じ局面で勝敗が食い違った印にする
+// --------------------------------------------------
+#define CENTER   0x0000001818000000
+#define CONFLICT 0x0000000800000000
+
+// --------------------------------------------------
+// 整列時のバッファの最小レコード数
+// --------------------------------------------------
+#define SORT_MIN_RECORDS 1024
+
+// --------------------------------------------------
+// 基数ソートをやめて比較ソートにするレコード数
+// --------------------------------------------------
+#define RADIX_MIN_RECORDS 64
+
+// --------------------------------------------------
+// 関数のプロトタイプ宣言
+// --------------------------------------------------
+// レコードの大小比較
+bool record_less(const pos_record_t&, const pos_record_t&);
+// レコードが同じ局面かどうか
+bool record_same(const pos_record_t&, const pos_record_t&);
+// 同じ局面のレコードの勝敗をまとめる
+void merge_outcome(pos_record_t*, const pos_record_t*);
+// 整列済みの配列から重複を除く
+size_t unique_records(pos_record_t*, size_t);
+// レコードを基数ソートする
+void radix_sort_records(pos_record_t*, pos_record_t*, size_t, int, bool);
+// 基数ソートの桁を取り出す
+int record_digit(const pos_record_t*, int);
+// ヘッダを読み込んでレコード数を調べる
+bool read_store_header(int, store_file_header_t*, uint64_t*);
+// ヘッダを書き込む
+bool write_store_header(int, uint32_t);
+// ファイルの指定位置からすべて読み込む
+bool pread_full(int, void*, size_t, off_t);
+// ファイルへすべて書き込む
+bool write_full(int, const void*, size_t);
+
+// ==================================================
+// 局面をレコードに変換する
+// ==================================================
+void pack_position(board_t *board, outcome_t outcome, pos_record_t *rec) {
+  uint64_t tag = (uint64_t)outcome;
+  rec->own = get_own_bb(board);
+  rec->opp = (get_opp_bb(board) & ~CENTER) | ((tag & 3) << 27);
+}
+
+// ==================================================
+// レコードから石の配置を取り出す
+// ==================================================
+void unpack_position(const pos_record_t *rec, bitboard_t *own, bitboard_t *opp) {
+  *own = rec->own;
+  *opp = (rec->opp & ~CENTER) | (CENTER & ~rec->own);
+}
+
+// ==================================================
+// レコードの勝敗を取り出す
+// 勝敗が食い違っていたものは不明とする
+// ==================================================
+outcome_t record_outcome(const pos_record_t *rec) {
+  if (rec->opp & CONFLICT) {
+    return OUTCOME_UNKNOWN;
+  }
+  return (outcome_t)((rec->opp >> 27) & 3);
+}
+
+// ==================================================
+// 局面ファイルを追記用に開く
+// 整列済みのファイルに追記すると未整列に戻る
+// ==================================================
+store_t* open_store(const char *path) {
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    return NULL;
+  }
+  store_file_header_t header;
+  uint64_t count;
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0;
+  if (ok && st.st_size == 0) {
+    ok = write_store_header(fd, 0);
+  } else if (ok) {
+    ok = read_store_header(fd, &header, &count)
+      && (header.flags == 0 || write_store_header(fd, 0));
+  }
+  if (!ok || lseek(fd, 0, SEEK_END) < 0) {
+    close(fd);
+    return NULL;
+  }
+  store_t *store = new store_t;
+  store->fd = fd;
+  store->count = 0;
+  return store;
+}
+
+// ==================================================
+// 局面ファイルにレコードを追記する
+// ==================================================
+bool append_record(store_t *store, const pos_record_t *rec) {
+  if (store->count == STORE_BUFFER) {
+    if (!write_full(store->fd, store->buffer, sizeof(store->buffer))) {
+      return false;
+    }
+    store->count = 0;
+  }
+  store->buffer[store->count++] = *rec;
+  return true;
+}
+
+// ==================================================
+// 局面ファイルに局面を追記する
+// ==================================================
+bool append_position(store_t *store, board_t *board, outcome_t outcome) {
+  pos_record_t rec;
+  pack_position(board, outcome, &rec);
+  return append_record(store, &rec);
+}
+
+// ==================================================
+// 局面ファイルを閉じる
+// バッファに残ったレコードを書き込めたかどうかを返す
+// ==================================================
+bool close_store(store_t *store) {
+  bool ok = write_full(store->fd, store->buffer, store->count * sizeof(pos_record_t));
+  ok = close(store->fd) == 0 && ok;
+  delete store;
+  return ok;
+}
+
+// ==================================================
+// 局面ファイルを整列して重複を除く
+// mem_size以内のメモリで外部マージソートする
+// 1. 入力をメモリに入るだけ読んで整列し一時ファイルへ書き出す
+// 2. 書き出した列をまとめてマージしながら重複を除く
+// 同じ局面が複数あれば勝敗のわかっているものを残し
+// 勝敗が食い違っていれば不明とする
+// ==================================================
+bool sort_store(const char *in_path, const char *out_path, size_t mem_size) {
+  int in = open(in_path, O_RDONLY);
+  if (in < 0) {
+    return false;
+  }
+  store_file_header_t header;
+  uint64_t count;
+  if (!read_store_header(in, &header, &count)) {
+    close(in);
+    return false;
+  }
+  // 出力は一時ファイルに書き出してから置き換える
+  char tmp[PATH_MAX], runs_path[PATH_MAX];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", out_path);
+  snprintf(runs_path, sizeof(runs_path), "%s.runs", out_path);
+  int out = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  int runs = open(runs_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  unlink(runs_path);
+  bool ok = out >= 0 && runs >= 0 && write_store_header(out, STORE_SORTED)
+         && lseek(out, 0, SEEK_END) >= 0;
+  // 作業領域はmem_sizeを1度だけ確保して1.と2.で使い回す
+  // 1.では前半を読み込み，後半を基数ソートの作業に使う
+  // 2.では出力用に4分の1を取り，残りを列ごとの読み込みに分ける
+  // 列が多すぎて最小の読み込み単位に足りないときだけ大きく取る
+  size_t chunk = std::max(mem_size / sizeof(pos_record_t) / 2, (size_t)SORT_MIN_RECORDS);
+  bool single = count <= chunk;
+  size_t k = single ? 1 : (count + chunk - 1) / chunk;
+  size_t out_n = chunk / 2;
+  size_t per = std::max((2 * chunk - out_n) / k, (size_t)SORT_MIN_RECORDS / 4);
+  size_t area_n = single ? 2 * std::max(count, (uint64_t)1) : std::max(2 * chunk, out_n + per * k);
+  void *area = mmap(NULL, area_n * sizeof(pos_record_t), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ok = ok && area != MAP_FAILED;
+  // 基数ソートは256か所へ同時に書くのでTLBが足りるよう大きなページを頼む
+  if (ok) madvise(area, area_n * sizeof(pos_record_t), MADV_HUGEPAGE);
+  // 1. 整列済みの列を作る
+  // 列が1つなら一時ファイルを経由せず出力へ書く
+  std::vector<uint64_t> run_start, run_count;
+  uint64_t done = 0, written = 0;
+  if (ok) {
+    pos_record_t *buf = (pos_record_t*)area, *work = buf + area_n / 2;
+    while (ok && done < count) {
+      size_t n = std::min((uint64_t)chunk, count - done);
+      ok = pread_full(in, buf, n * sizeof(pos_record_t),
+                      sizeof(store_file_header_t) + done * sizeof(pos_record_t));
+      if (!ok) break;
+      done += n;
+      radix_sort_records(buf, work, n, 15, true);
+      n = unique_records(buf, n);
+      run_start.push_back(written);
+      run_count.push_back(n);
+      ok = write_full(single ? out : runs, buf, n * sizeof(pos_record_t));
+      written += n;
+    }
+  }
+  close(in);
+  // 2. 列をマージする
+  // 各列の先頭を敗者木で比べて最小のものを取り出す
+  // 木の節tには節tの部分木で負けた列を置き，tree[0]が全体の勝者
+  // 列iの葉は節i+kなので1レコードあたりの比較は木の高さ分で済む
+  if (ok && run_start.size() > 1) {
+    pos_record_t *in_buf = (pos_record_t*)area, *out_buf = in_buf + per * k;
+    std::vector<const pos_record_t*> cur(k), end(k);
+    std::vector<uint64_t> next(k, 0);
+    // 列iの読み込みバッファを補充し，続きの読み込みを先に頼んでおく
+    auto refill = [&](size_t i) {
+      size_t len = std::min((uint64_t)per, run_count[i] - next[i]);
+      off_t offset = (run_start[i] + next[i]) * sizeof(pos_record_t);
+      bool r = pread_full(runs, &in_buf[i * per], len * sizeof(pos_record_t), offset);
+      posix_fadvise(runs, offset + len * sizeof(pos_record_t), per * sizeof(pos_record_t),
+                    POSIX_FADV_WILLNEED);
+      cur[i] = &in_buf[i * per];
+      end[i] = cur[i] + len;
+      next[i] += len;
+      return r;
+    };
+    // 列aの先頭が列bの先頭より先に出るかどうか
+    // kは木を作るときの番兵でどの列にも勝ち，尽きた列はどの列にも負ける
+    auto beats = [&](size_t a, size_t b) {
+      if (a == k || b == k) return a == k;
+      if (cur[a] == end[a] || cur[b] == end[b]) return cur[b] == end[b] && cur[a] != end[a];
+      return record_less(*cur[a], *cur[b]);
+    };
+    // 列iの葉から根まで勝ち上がらせる
+    std::vector<size_t> tree(k, k);
+    auto replay = [&](size_t i) {
+      for (size_t t = (i + k) / 2; t > 0; t /= 2) {
+        if (beats(tree[t], i)) std::swap(i, tree[t]);
+      }
+      tree[0] = i;
+    };
+    for (size_t i = 0; i < k && ok; i++) {
+      ok = refill(i);
+    }
+    for (size_t i = k; i-- > 0;) {
+      replay(i);
+    }
+    size_t n = 0;
+    while (ok && cur[tree[0]] != end[tree[0]]) {
+      size_t i = tree[0];
+      const pos_record_t *rec = cur[i]++;
+      if (n > 0 && record_same(out_buf[n - 1], *rec)) {
+        merge_outcome(&out_buf[n - 1], rec);
+      } else {
+        // 書き込みバッファが一杯なら最後の1つを残して書き出す
+        if (n == out_n) {
+          ok = write_full(out, out_buf, (n - 1) * sizeof(pos_record_t));
+          out_buf[0] = out_buf[n - 1];
+          n = 1;
+        }
+        out_buf[n++] = *rec;
+      }
+      if (cur[i] == end[i] && next[i] < run_count[i]) {
+        ok = ok && refill(i);
+      }
+      replay(i);
+    }
+    ok = ok && write_full(out, out_buf, n * sizeof(pos_record_t));
+  }
+  if (area != MAP_FAILED) munmap(area, area_n * sizeof(pos_record_t));
+  if (runs >= 0) close(runs);
+  if (out >= 0) {
+    ok = fsync(out) == 0 && ok;
+    ok = close(out) == 0 && ok;
+  }
+  if (!ok || rename(tmp, out_path) != 0) {
+    unlink(tmp);
+    return false;
+  }
+  return true;
+}
+
+// ==================================================
+// 整列済みの局面ファイルを開く
+// ==================================================
+pos_index_t* open_index(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  store_file_header_t header;
+  uint64_t count;
+  if (!read_store_header(fd, &header, &count) || header.flags != STORE_SORTED) {
+    close(fd);
+    return NULL;
+  }
+  size_t size = sizeof(store_file_header_t) + count * sizeof(pos_record_t);
+  void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+  madvise(map, size, MADV_RANDOM);
+  pos_index_t *index = new pos_index_t;
+  index->map = map;
+  index->size = size;
+  index->records = (const pos_record_t*)((const uint8_t*)map + sizeof(store_file_header_t));
+  index->count = count;
+  return index;
+}
+
+// ==================================================
+// 索引から局面を探す
+// 見つかればその勝敗をoutcomeに入れる
+// ==================================================
+bool find_position(pos_index_t *index, board_t *board, outcome_t *outcome) {
+  // 勝敗が不明のレコードは同じ局面の中で先頭に並ぶ
+  pos_record_t key;
+  pack_position(board, OUTCOME_UNKNOWN, &key);
+  const pos_record_t *end = index->records + index->count;
+  const pos_record_t *p = std::lower_bound(index->records, end, key, record_less);
+  if (p == end || !record_same(*p, key)) {
+    return false;
+  }
+  if (outcome != NULL) {
+    *outcome = record_outcome(p);
+  }
+  return true;
+}
+
+// ==================================================
+// 索引を閉じる
+// ==================================================
+void close_index(pos_index_t *index) {
+  munmap(index->map, index->size);
+  delete index;
+}
+
+// ==================================================
+// レコードの大小比較
+// 局面(ownと中央以外のopp)の順に並べ
+// 同じ局面どうしは中央のビット(勝敗)の順に並べる
+// ==================================================
+bool record_less(const pos_record_t &a, const pos_record_t &b) {
+  if (a.own != b.own) {
+    return a.own < b.own;
+  }
+  if ((a.opp & ~CENTER) != (b.opp & ~CENTER)) {
+    return (a.opp & ~CENTER) < (b.opp & ~CENTER);
+  }
+  return (a.opp & CENTER) < (b.opp & CENTER);
+}
+
+// ==================================================
+// レコードが同じ局面かどうか
+// ==================================================
+bool record_same(const pos_record_t &a, const pos_record_t &b) {
+  return a.own == b.own && ((a.opp ^ b.opp) & ~CENTER) == 0;
+}
+
+// ==================================================
+// 同じ局面のレコードの勝敗をまとめる
+// 勝敗が不明(付いていない)なら他方の勝敗を使い
+// 勝敗が食い違えば食い違った印を付けて不明とする
+// 食い違った印は他のどの勝敗とまとめても残るので
+// 結果はまとめる順序によらない
+// ==================================================
+void merge_outcome(pos_record_t *dest, const pos_record_t *from) {
+  uint64_t a = dest->opp & CENTER, b = from->opp & CENTER;
+  if (a == b || b == 0 || (a & CONFLICT)) {
+    return;
+  }
+  if (a == 0 || (b & CONFLICT)) {
+    dest->opp = (dest->opp & ~CENTER) | b;
+  } else {
+    dest->opp = (dest->opp & ~CENTER) | CONFLICT;
+  }
+}
+
+// ==================================================
+// 整列済みの配列から重複を除く
+// 残ったレコード数を返す
+// ==================================================
+size_t unique_records(pos_record_t *recs, size_t n) {
+  if (n == 0) {
+    return 0;
+  }
+  size_t m = 1;
+  for (size_t i = 1; i < n; i++) {
+    if (record_same(recs[m - 1], recs[i])) {
+      merge_outcome(&recs[m - 1], &recs[i]);
+    } else {
+      recs[m++] = recs[i];
+    }
+  }
+  return m;
+}
+
+// ==================================================
+// レコードを基数ソートする
+// 局面の16バイトを上位から1バイトずつ振り分け(MSD)
+// 振り分けた山が小さくなったら比較ソートで仕上げる
+// 下位から振り分けるLSDは16回とも全レコードを動かすので
+// キャッシュに収まらない大きさではこちらの方が速い
+// dataの整列結果はin_dataならdataに，そうでなければspareに置く
+// spareはdataと同じ大きさの作業領域
+// ==================================================
+void radix_sort_records(pos_record_t *data, pos_record_t *spare, size_t n, int digit, bool in_data) {
+  // 全レコードで同じ値の桁は飛ばす
+  size_t count[256];
+  for (; digit >= 0 && n > RADIX_MIN_RECORDS; digit--) {
+    memset(count, 0, sizeof(count));
+    for (size_t i = 0; i < n; i++) {
+      count[record_digit(&data[i], digit)]++;
+    }
+    if (count[record_digit(&data[0], digit)] != n) break;
+  }
+  if (digit < 0 || n <= RADIX_MIN_RECORDS) {
+    // 関数ポインタで渡すと比較がインライン展開されない
+    std::sort(data, data + n, [](const pos_record_t &a, const pos_record_t &b) {
+      return record_less(a, b);
+    });
+    if (!in_data) memcpy(spare, data, n * sizeof(pos_record_t));
+    return;
+  }
+  // spareへ振り分けて山ごとに次の桁で整列する
+  // 山の整列結果はspareとdataを入れ替えた側に置く
+  size_t start[256], pos[256], sum = 0;
+  for (int b = 0; b < 256; b++) {
+    start[b] = pos[b] = sum;
+    sum += count[b];
+  }
+  for (size_t i = 0; i < n; i++) {
+    spare[pos[record_digit(&data[i], digit)]++] = data[i];
+  }
+  for (int b = 0; b < 256; b++) {
+    if (count[b] == 0) continue;
+    radix_sort_records(spare + start[b], data + start[b], count[b], digit - 1, !in_data);
+  }
+}
+
+// ==================================================
+// 基数ソートの桁(1バイト)を取り出す
+// 15〜8桁目がownの上位から，7〜0桁目が中央を除いたoppの上位から
+// ==================================================
+int record_digit(const pos_record_t *rec, int digit) {
+  if (digit >= 8) {
+    return (rec->own >> ((digit - 8) * 8)) & 255;
+  }
+  return ((rec->opp & ~CENTER) >> (digit * 8)) & 255;
+}
+
+// ==================================================
+// ヘッダを読み込んでレコード数を調べる
+// ==================================================
+bool read_store_header(int fd, store_file_header_t *header, uint64_t *count) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(store_file_header_t)
+      || !pread_full(fd, header, sizeof(store_file_header_t), 0)) {
+    return false;
+  }
+  size_t body_size = st.st_size - sizeof(store_file_header_t);
+  if (memcmp(header->magic, STORE_FILE_MAGIC, sizeof(header->magic)) != 0
+      || header->version != STORE_FILE_VERSION
+      || body_size % sizeof(pos_record_t) != 0) {
+    return false;
+  }
+  *count = body_size / sizeof(pos_record_t);
+  return true;
+}
+
+// ==================================================
+// ヘッダを書き込む
+// ==================================================
+bool write_store_header(int fd, uint32_t flags) {
+  store_file_header_t header;
+  memcpy(header.magic, STORE_FILE_MAGIC, sizeof(header.magic));
+  header.version = STORE_FILE_VERSION;
+  header.flags   = flags;
+  return pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+}
+
+// ==================================================
+// ファイルの指定位置からすべて読み込む
+// ==================================================
+bool pread_full(int fd, void *buf, size_t size, off_t offset) {
+  uint8_t *p = (uint8_t*)buf;
+  while (size > 0) {
+    ssize_t n = pread(fd, p, size, offset);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+// ==================================================
+// ファイルへすべて書き込む
+// ==================================================
+bool write_full(int fd, const void *buf, size_t size) {
+  const uint8_t *p = (const uint8_t*)buf;
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
@@ -0,0 +1,75 @@
+// ==================================================
+// store.hpp
+// 局面ファイルのヘッダファイル
+// ==================================================
+
+// --------------------------------------------------
+// 局面のレコード(16バイト)
+// 手番側から見た石の配置で持つので手番そのものは持たない
+// 中央の4マスは必ず石があり相手の石はownから決まるので
+// oppの中央4ビットには代わりに勝敗(outcome_t)を入れる
+// 整列で同じ局面の勝敗が食い違ったら不明にする
+// --------------------------------------------------
+typedef struct {
+  uint64_t own; //手番側の石
+  uint64_t opp; //相手の石(中央4マスは勝敗)
+} pos_record_t;
+
+// --------------------------------------------------
+// 手番側から見た勝敗
+// --------------------------------------------------
+typedef enum {
+  OUTCOME_UNKNOWN, //不明
+  OUTCOME_LOSS,    //負け
+  OUTCOME_DRAW,    //引き分け
+  OUTCOME_WIN,     //勝ち
+} outcome_t;
+
+// --------------------------------------------------
+// 追記用に開いた局面ファイル
+// レコードはバッファに溜めてからまとめて書き込む
+// --------------------------------------------------
+#define STORE_BUFFER 65536
+
+typedef struct {
+  int fd;                            //ファイル
+  size_t count;                      //バッファ内のレコード数
+  pos_record_t buffer[STORE_BUFFER]; //書き込みバッファ
+} store_t;
+
+// --------------------------------------------------
+// 整列済みの局面ファイル(索引)
+// ファイル全体をマップして二分探索する
+// --------------------------------------------------
+typedef struct {
+  void *map;                   //マップした領域
+  size_t size;                 //マップした大きさ
+  const pos_record_t *records; //レコード(整列済み)
+  uint64_t count;              //レコード数
+} pos_index_t;
+
+// --------------------------------------------------
+// 関数のプロトタイプ宣言(store.cpp)
+// --------------------------------------------------
+// 局面をレコードに変換する
+void pack_position(board_t*, outcome_t, pos_record_t*);
+// レコードから石の配置を取り出す
+void unpack_position(const pos_record_t*, bitboard_t*, bitboard_t*);
+// レコードの勝敗を取り出す
+outcome_t record_outcome(const pos_record_t*);
+// 局面ファイルを追記用に開く
+store_t* open_store(const char*);
+// 局面ファイルにレコードを追記する
+bool append_record(store_t*, const pos_record_t*);
+// 局面ファイルに局面を追記する
+bool append_position(store_t*, board_t*, outcome_t);
+// 局面ファイルを閉じる
+bool close_store(store_t*);
+// 局面ファイルを整列して重複を除く
+bool sort_store(const char*, const char*, size_t);
+// 整列済みの局面ファイルを開く
+pos_index_t* open_index(const char*);
+// 索引から局面を探す
+bool find_position(pos_index_t*, board_t*, outcome_t*);
+// 索引を閉じる
+void close_index(pos_index_t*);